@@ -0,0 +1,85 @@
+#include "bench.h"
+#include "../elf_loader.h"
+#include "../fdl_resolve.h"
+#include "../fdl_async.h"
+
+/* Usage: async_bench [library ...]
+ *
+ * Bootstraps in forked children: one opens the libraries one after
+ * the other with the foreign dlopen, the others start every open with
+ * fdl_dlopen_async(), with and without the DT_NEEDED readahead, and then
+ * wait for all of them. */
+
+#define DL_APP_DEFAULT "/bin/sleep"
+#define MAX_LIBS 16
+
+static const char *g_default_libs[] = {
+	"libm.so.6", "libz.so.1", "libxml2.so.2", "libsqlite3.so.0",
+	"libcrypto.so.3", "libstdc++.so.6",
+};
+static const char **g_libs = g_default_libs;
+static int g_nlibs = sizeof(g_default_libs) / sizeof(g_default_libs[0]);
+
+static void sync_main(void)
+{
+	void *(*my_dlopen)(const char *, int) = (void *(*)(const char *, int))fdl_dlopen_sym(NULL);
+	unsigned long t0 = bench_now_ns();
+	int i, failed = 0;
+
+	for (i = 0; i < g_nlibs; i++)
+		failed += my_dlopen(g_libs[i], RTLD_NOW) == NULL;
+	z_fdprintf(1, "dlopen mode=sync libs=%d failed=%d us=%lu\n", g_nlibs, failed,
+			   z_udivmod(bench_now_ns() - t0, 1000, NULL));
+}
+
+static void async_run(const char *mode, int flags)
+{
+	fdl_future_t *f[MAX_LIBS];
+	unsigned long t0 = bench_now_ns(), t_issued;
+	int i, failed = 0;
+
+	for (i = 0; i < g_nlibs; i++)
+		f[i] = fdl_dlopen_async(g_libs[i], flags);
+	t_issued = bench_now_ns();
+	for (i = 0; i < g_nlibs; i++)
+		failed += !f[i] || fdl_wait(f[i]) == NULL;
+	z_fdprintf(1, "dlopen mode=%s libs=%d failed=%d us=%lu issue_us=%lu\n",
+			   mode, g_nlibs, failed, z_udivmod(bench_now_ns() - t0, 1000, NULL),
+			   z_udivmod(t_issued - t0, 1000, NULL));
+}
+
+static void async_main(void)
+{
+	async_run("async", RTLD_NOW);
+}
+
+static void prefetch_main(void)
+{
+	async_run("async+prefetch", RTLD_NOW | FDL_ASYNC_PREFETCH);
+}
+
+static void run(void (*fn)(void))
+{
+	char *targv[] = { (char *)DL_APP_DEFAULT, (char *)"x" };
+
+	if (z_fork() == 0)
+	{
+		fdl_set_main(fn);
+		exec_elf(DL_APP_DEFAULT, 2, targv);
+		z_exit(1);
+	}
+	z_wait4(-1, NULL, 0, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+	{
+		g_libs = (const char **)&argv[1];
+		g_nlibs = argc - 1 < MAX_LIBS ? argc - 1 : MAX_LIBS;
+	}
+	run(sync_main);
+	run(async_main);
+	run(prefetch_main);
+	z_exit(0);
+}
@@ -0,0 +1,85 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../z_syscalls.h"
+#include "../z_utils.h"
+
+#ifdef Z_SMALL
+/* SMALL builds print nothing. The arguments stay referenced, but are not
+ * computed, so what a bench would have printed doesn't look unused. */
+static inline void bench_discard(int fd, ...)
+{
+	(void)fd;
+}
+
+#undef z_fdprintf
+#define z_fdprintf(fd, ...)                    \
+	do                                         \
+	{                                          \
+		if (0)                                 \
+			bench_discard((fd), __VA_ARGS__);  \
+	} while (0)
+#endif
+
+static inline unsigned long bench_now_ns(void)
+{
+	struct timespec ts;
+
+	z_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static inline unsigned long bench_atoul(const char *s, unsigned long dflt)
+{
+	unsigned long v = 0;
+
+	if (!s || !*s)
+		return dflt;
+	for (; *s >= '0' && *s <= '9'; s++)
+		v = v * 10 + (*s - '0');
+	return v;
+}
+
+static inline void bench_sift(unsigned long *a, unsigned long i, unsigned long n)
+{
+	for (;;)
+	{
+		unsigned long c = 2 * i + 1, t;
+		if (c >= n)
+			return;
+		if (c + 1 < n && a[c + 1] > a[c])
+			c++;
+		if (a[i] >= a[c])
+			return;
+		t = a[i];
+		a[i] = a[c];
+		a[c] = t;
+		i = c;
+	}
+}
+
+/* Heapsort, no recursion and no extra memory. */
+static inline void bench_sort(unsigned long *a, unsigned long n)
+{
+	unsigned long i, t;
+
+	for (i = n / 2; i-- > 0;)
+		bench_sift(a, i, n);
+	for (i = n; i-- > 1;)
+	{
+		t = a[0];
+		a[0] = a[i];
+		a[i] = t;
+		bench_sift(a, 0, i);
+	}
+}
+
+/* p-th percentile of a sorted array. */
+static inline unsigned long bench_pct(const unsigned long *a, unsigned long n, unsigned p)
+{
+	if (n == 0)
+		return 0;
+	return a[z_udivmod((n - 1) * p, 100, NULL)];
+}
+
+#endif /* BENCH_H */
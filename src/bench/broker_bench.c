@@ -0,0 +1,115 @@
+#include "bench.h"
+#include "../elf_loader.h"
+#include "../fdl_broker.h"
+
+/* Usage: broker_bench [clients] [calls per client] [host program]
+ *
+ * Forks one broker that bootstraps the foreign runtime and N static clients
+ * that call the foreign strlen() through the ring, then reports throughput
+ * and per-call round-trip latency percentiles. */
+
+#define DL_APP_DEFAULT "/bin/sleep"
+#define MAX_CLIENTS 64
+#define MAX_SAMPLES 8192
+
+typedef struct
+{
+	unsigned long nsamples[MAX_CLIENTS];
+	unsigned long errors[MAX_CLIENTS];
+	unsigned long lat[MAX_CLIENTS * MAX_SAMPLES];
+} results_t;
+
+static fdl_ring_t *g_ring;
+
+static void broker_main(void)
+{
+	fdl_broker_serve(g_ring);
+}
+
+static void client(int id, long sym, unsigned long calls, results_t *res)
+{
+	static const char msg[] = "hello from a static client";
+	unsigned long args[1] = { 0 }, *lat = &res->lat[id * MAX_SAMPLES];
+	unsigned long i, t;
+	char blob[sizeof(msg)];
+
+	for (i = 0; i < calls; i++)
+	{
+		z_memcpy(blob, msg, sizeof(msg));
+		t = bench_now_ns();
+		if (fdl_broker_call(g_ring, sym, 1, args, 1, blob, sizeof(blob)) != (long)sizeof(msg) - 1)
+			res->errors[id]++;
+		t = bench_now_ns() - t;
+		if (i < MAX_SAMPLES)
+			lat[i] = t;
+	}
+	res->nsamples[id] = calls < MAX_SAMPLES ? calls : MAX_SAMPLES;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long nclients = bench_atoul(argc > 1 ? argv[1] : NULL, 4);
+	unsigned long calls = bench_atoul(argc > 2 ? argv[2] : NULL, 100000);
+	const char *app = argc > 3 ? argv[3] : DL_APP_DEFAULT;
+	unsigned long i, n, t0, us, errors = 0;
+	results_t *res;
+	pid_t broker;
+	long sym;
+	int fd;
+
+	if (nclients == 0 || nclients > MAX_CLIENTS)
+		z_errx(1, "clients must be 1..%d", MAX_CLIENTS);
+	if ((g_ring = fdl_broker_create(&fd)) == NULL)
+		z_errx(1, "can't create broker ring");
+	res = z_mmap(NULL, sizeof(*res), PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == (void *)-1)
+		z_errx(1, "can't map results");
+
+	if ((broker = z_fork()) == 0)
+	{
+		char *targv[] = { (char *)app, (char *)"x" };
+		fdl_set_main(broker_main);
+		exec_elf(app, 2, targv);
+		z_exit(1);
+	}
+	while (!__atomic_load_n(&g_ring->ready, __ATOMIC_ACQUIRE))
+		z_futex_wait(&g_ring->ready, 0);
+
+	if ((sym = fdl_broker_resolve(g_ring, "", "strlen")) < 0)
+		z_errx(1, "broker can't resolve strlen");
+
+	t0 = bench_now_ns();
+	for (i = 0; i < nclients; i++)
+	{
+		if (z_fork() == 0)
+		{
+			client(i, sym, calls, res);
+			z_exit(0);
+		}
+	}
+	for (i = 0; i < nclients; i++)
+		z_wait4(-1, NULL, 0, NULL);
+	us = z_udivmod(bench_now_ns() - t0, 1000, NULL);
+
+	fdl_broker_stop(g_ring);
+	z_wait4(broker, NULL, 0, NULL);
+
+	/* Pack the per-client samples together and sort them once. */
+	for (i = 0, n = 0; i < nclients; i++)
+	{
+		z_memcpy(&res->lat[n], &res->lat[i * MAX_SAMPLES],
+				 res->nsamples[i] * sizeof(res->lat[0]));
+		n += res->nsamples[i];
+		errors += res->errors[i];
+	}
+	bench_sort(res->lat, n);
+
+	z_fdprintf(1, "broker clients=%lu calls=%lu elapsed_us=%lu calls_per_s=%lu "
+				  "p50_ns=%lu p90_ns=%lu p99_ns=%lu max_ns=%lu errors=%lu\n",
+			   nclients, nclients * calls, us,
+			   us ? z_udivmod(nclients * calls * 1000000, us, NULL) : 0,
+			   bench_pct(res->lat, n, 50), bench_pct(res->lat, n, 90),
+			   bench_pct(res->lat, n, 99), n ? res->lat[n - 1] : 0, errors);
+	z_exit(errors ? 1 : 0);
+}
@@ -0,0 +1,192 @@
+#include "bench.h"
+#include "../elf_loader.h"
+#include "../fdl_direct.h"
+#include "../fdl_resolve.h"
+
+/* Usage: direct_bench [rounds] [plugin] [host program]
+ *
+ * First, from main() before exec_elf(), opens the libc-free plugin_pure.so
+ * next to this binary [rounds] times with fdl_direct_open(), calls into it
+ * and closes it again: the case with no foreign runtime at all. Then, once
+ * the runtime is up, does the same with the plugin (bench/plugin.so by
+ * default) through fdl_direct_open() and through the foreign dlopen().
+ * Prints percentiles of all three and boot_ns, the time from exec_elf()
+ * until the runtime is up, which only the early plugin did not wait for.
+ * Exits 1 if a plugin misbehaves. */
+
+#define DL_APP_DEFAULT "/bin/sleep"
+#define MAX_ROUNDS 10000
+
+static unsigned long g_early[MAX_ROUNDS], g_direct[MAX_ROUNDS], g_dl[MAX_ROUNDS];
+static unsigned long g_rounds, g_errors;
+/* exec_elf() to our foreign main, what an early plugin does not wait for. */
+static unsigned long g_boot;
+static char g_plugin[256], g_pure[256];
+
+static int host_add(int a, int b)
+{
+	return a + b;
+}
+
+static const fdl_export_t g_exports[] = {
+	{ "host_add", (void *)host_add },
+	{ NULL, NULL },
+};
+
+typedef void *(*sym_fn_t)(void *, const char *);
+
+static void check(const char *what, int ok)
+{
+	if (!ok && g_errors++ < 10)
+		z_fdprintf(2, "direct mismatch: %s\n", what);
+}
+
+/* direct is set when the static side's exports are bound. */
+static void exercise(void *h, sym_fn_t sym, int direct)
+{
+	int (*ready)(void) = (int (*)(void))sym(h, "plugin_ready");
+	int (*apply)(int, int) = (int (*)(int, int))sym(h, "plugin_apply");
+	unsigned long (*len)(int) = (unsigned long (*)(int))sym(h, "plugin_len");
+	int (*host)(int, int) = (int (*)(int, int))sym(h, "plugin_host");
+	int *counter = (int *)sym(h, "plugin_counter");
+
+	if (!ready || !apply || !len || !host || !counter)
+	{
+		check("symbols", 0);
+		return;
+	}
+	check("init", ready() == 42);
+	check("relative", apply(0, 5) == 10 && apply(1, 5) == 6);
+	check("glob_dat", *counter == 2);
+	check("libc", len(0) == 5 && len(1) == 4);
+	check("export", host(2, 3) == (direct ? 5 : -1));
+}
+
+static void *direct_sym(void *h, const char *name)
+{
+	return fdl_direct_sym(h, name);
+}
+
+/* plugin_pure.so has no libc import, hence no plugin_len. */
+static void exercise_pure(fdl_direct_t *h)
+{
+	int (*ready)(void) = (int (*)(void))fdl_direct_sym(h, "plugin_ready");
+	int (*apply)(int, int) = (int (*)(int, int))fdl_direct_sym(h, "plugin_apply");
+	int (*host)(int, int) = (int (*)(int, int))fdl_direct_sym(h, "plugin_host");
+	int *counter = (int *)fdl_direct_sym(h, "plugin_counter");
+
+	if (!ready || !apply || !host || !counter)
+	{
+		check("pure symbols", 0);
+		return;
+	}
+	check("pure init", ready() == 42);
+	check("pure relative", apply(0, 5) == 10 && apply(1, 5) == 6);
+	check("pure glob_dat", *counter == 2);
+	check("pure export", host(2, 3) == 5);
+}
+
+/* Opens plugin_pure.so before there is a foreign runtime. */
+static void bench_early(void)
+{
+	unsigned long i, t0;
+
+	for (i = 0; i < g_rounds; i++)
+	{
+		fdl_direct_t *h;
+
+		t0 = bench_now_ns();
+		if ((h = fdl_direct_open(g_pure, g_exports)) == NULL)
+			z_errx(1, "can't load %s directly", g_pure);
+		exercise_pure(h);
+		fdl_direct_close(h);
+		g_early[i] = bench_now_ns() - t0;
+	}
+}
+
+/* dir of argv0 (with its slash), then name, into buf. */
+static void next_to(char *buf, size_t size, const char *argv0, const char *name)
+{
+	const char *slash = NULL;
+	size_t n = 0;
+
+	for (const char *p = argv0; *p; p++)
+		if (*p == '/')
+			slash = p;
+	for (const char *p = argv0; slash && p <= slash && n < size - 1; p++)
+		buf[n++] = *p;
+	for (; *name && n < size - 1; name++)
+		buf[n++] = *name;
+	buf[n] = 0;
+}
+
+static void bench_main(void)
+{
+	void *(*my_dlopen)(const char *, int) = (void *(*)(const char *, int))fdl_dlopen_sym(NULL);
+	sym_fn_t my_dlsym = (sym_fn_t)fdl_dlsym_sym(NULL);
+	int (*my_dlclose)(void *) = (int (*)(void *))fdl_default_sym("dlclose");
+	unsigned long i, t0;
+
+	g_boot = bench_now_ns() - g_boot;
+	for (i = 0; i < g_rounds; i++)
+	{
+		fdl_direct_t *h;
+
+		t0 = bench_now_ns();
+		if ((h = fdl_direct_open(g_plugin, g_exports)) == NULL)
+			z_errx(1, "can't load %s directly", g_plugin);
+		exercise(h, direct_sym, 1);
+		fdl_direct_close(h);
+		g_direct[i] = bench_now_ns() - t0;
+	}
+
+	for (i = 0; my_dlclose && i < g_rounds; i++)
+	{
+		void *h;
+
+		t0 = bench_now_ns();
+		if ((h = my_dlopen(g_plugin, RTLD_NOW)) == NULL)
+			z_errx(1, "can't dlopen %s", g_plugin);
+		exercise(h, my_dlsym, 0);
+		my_dlclose(h);
+		g_dl[i] = bench_now_ns() - t0;
+	}
+
+	bench_sort(g_early, g_rounds);
+	bench_sort(g_direct, g_rounds);
+	bench_sort(g_dl, g_rounds);
+	z_fdprintf(1, "direct rounds=%lu boot_ns=%lu early_ns_p50=%lu early_ns_p99=%lu"
+				  " direct_ns_p50=%lu direct_ns_p99=%lu"
+				  " dlopen_ns_p50=%lu dlopen_ns_p99=%lu errors=%lu\n",
+			   g_rounds, g_boot, bench_pct(g_early, g_rounds, 50), bench_pct(g_early, g_rounds, 99),
+			   bench_pct(g_direct, g_rounds, 50), bench_pct(g_direct, g_rounds, 99),
+			   bench_pct(g_dl, g_rounds, 50), bench_pct(g_dl, g_rounds, 99), g_errors);
+	z_exit(g_errors ? 1 : 0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *app = argc > 3 ? argv[3] : DL_APP_DEFAULT;
+	char *targv[] = { (char *)app, (char *)"x" };
+	const char *plugin = argc > 2 ? argv[2] : NULL;
+	size_t n = 0;
+
+	g_rounds = bench_atoul(argc > 1 ? argv[1] : NULL, 1000);
+	if (g_rounds == 0 || g_rounds > MAX_ROUNDS)
+		g_rounds = MAX_ROUNDS;
+	if (!plugin)
+		next_to(g_plugin, sizeof(g_plugin), argv[0], "plugin.so");
+	else
+	{
+		for (; *plugin && n < sizeof(g_plugin) - 1; plugin++)
+			g_plugin[n++] = *plugin;
+		g_plugin[n] = 0;
+	}
+	next_to(g_pure, sizeof(g_pure), argv[0], "plugin_pure.so");
+
+	bench_early();
+	fdl_set_main(bench_main);
+	g_boot = bench_now_ns();
+	exec_elf(app, 2, targv);
+	z_exit(1);
+}
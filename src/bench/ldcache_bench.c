@@ -0,0 +1,86 @@
+#include "bench.h"
+#include "../fdl_ldcache.h"
+
+/* Usage: ldcache_bench [soname ...]
+ *
+ * Resolves each soname through /etc/ld.so.cache and compares the cost of
+ * the first (binary searched) and repeated (memoized) lookups with probing
+ * LD_LIBRARY_PATH and the default directories with open(), which is what
+ * ld.so does before it gets to the cache. */
+
+#define ROUNDS 100000
+
+static const char *g_default_names[] = {
+	"libm.so.6", "libz.so.1", "libstdc++.so.6", "libnot-there.so.1",
+};
+
+static unsigned long probe(const char *dirs, const char *name)
+{
+	char path[512];
+	unsigned long n = 0;
+	const char *p;
+	int fd;
+
+	while (dirs && *dirs)
+	{
+		char *o = path;
+		for (p = dirs; *p && *p != ':' && o < path + 255; p++)
+			*o++ = *p;
+		*o++ = '/';
+		for (const char *q = name; *q && o < path + sizeof(path) - 1; q++)
+			*o++ = *q;
+		*o = 0;
+		n++;
+		if ((fd = z_open(path, O_RDONLY)) >= 0)
+		{
+			z_close(fd);
+			break;
+		}
+		dirs = *p ? p + 1 : p;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	const char **names = g_default_names;
+	int nnames = sizeof(g_default_names) / sizeof(g_default_names[0]);
+	char dirs[4096], *d = dirs, *lp = z_getenv("LD_LIBRARY_PATH");
+	const char *path, *dflt = "/lib/x86_64-linux-gnu:/usr/lib/x86_64-linux-gnu:/lib:/usr/lib";
+	unsigned long t0, first, memo, probe_ns, nprobe;
+	int i, r;
+
+	if (argc > 1)
+	{
+		names = (const char **)&argv[1];
+		nnames = argc - 1;
+	}
+	/* ld.so's order: LD_LIBRARY_PATH, then (past the cache) the defaults */
+	while (lp && *lp && d < dirs + sizeof(dirs) / 2)
+		*d++ = *lp++;
+	if (d > dirs)
+		*d++ = ':';
+	while (*dflt && d < dirs + sizeof(dirs) - 1)
+		*d++ = *dflt++;
+	*d = 0;
+
+	for (i = 0; i < nnames; i++)
+	{
+		t0 = bench_now_ns();
+		path = fdl_ldcache_lookup(names[i]);
+		first = bench_now_ns() - t0;
+
+		t0 = bench_now_ns();
+		for (r = 0; r < ROUNDS; r++)
+			fdl_ldcache_lookup(names[i]);
+		memo = z_udivmod(bench_now_ns() - t0, ROUNDS, NULL);
+
+		t0 = bench_now_ns();
+		nprobe = probe(dirs, names[i]);
+		probe_ns = bench_now_ns() - t0;
+
+		z_fdprintf(1, "ldcache name=%s path=%s first_ns=%lu memo_ns=%lu probe_opens=%lu probe_ns=%lu\n",
+				   names[i], path ? path : "-", first, memo, nprobe, probe_ns);
+	}
+	z_exit(0);
+}
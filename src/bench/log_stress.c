@@ -0,0 +1,140 @@
+#include "bench.h"
+#include "../elf_loader.h"
+#include "../fdl_pool.h"
+#include "../z_log.h"
+
+/* Usage: log_stress [tasks] [records] [host program]
+ *
+ * Bootstraps in a forked child whose stderr is a pipe, logs records from
+ * every task of a worker pool at once, then one more record after the
+ * pool is gone and exits without flushing. The parent reads the pipe:
+ * every record must come out whole, once and in its task's order, the
+ * last one included. Exits 1 on any mismatch. */
+
+#ifndef Z_SMALL
+#define DL_APP_DEFAULT "/bin/sleep"
+#define MAX_TASKS 64
+#define TAIL " abcdefghijklmnopqrstuvwxyz"
+
+static unsigned long g_tasks, g_records;
+static char g_out[8 << 20];
+
+static void task(void *arg)
+{
+	unsigned long w = (unsigned long)arg;
+
+	for (unsigned long i = 0; i < g_records; i++)
+		z_info("[ls] w=%lu i=%lu" TAIL "\n", w, i);
+}
+
+static void child_main(void)
+{
+	fdl_pool_t *p = fdl_pool_create(0, 0);
+
+	if (!p)
+		z_errx(1, "can't create pool");
+	for (unsigned long w = 0; w < g_tasks; w++)
+		fdl_pool_submit(p, task, (void *)w);
+	fdl_pool_wait(p);
+	fdl_pool_destroy(p);
+	/* Left in the buffer for z_exit(). */
+	z_info("[ls] done\n");
+	z_exit(0);
+}
+
+static const char *num(const char *p, unsigned long *v)
+{
+	const char *s = p;
+
+	*v = 0;
+	for (; *p >= '0' && *p <= '9'; p++)
+		*v = *v * 10 + (*p - '0');
+	return p == s ? NULL : p;
+}
+
+static int prefix(const char **p, const char *s)
+{
+	const char *q = *p;
+
+	while (*s && *q == *s)
+		q++, s++;
+	if (*s)
+		return 0;
+	*p = q;
+	return 1;
+}
+
+/* 1 if line is one of ours and whole. */
+static int check_line(const char *line, unsigned long *next, int *done)
+{
+	unsigned long w, i;
+
+	if (!z_strstr(line, "[ls]"))
+		return 1;
+	if (!z_strcmp(line, "[ls] done"))
+	{
+		*done += 1;
+		return 1;
+	}
+	if (!prefix(&line, "[ls] w=") || !(line = num(line, &w)) || w >= g_tasks ||
+		!prefix(&line, " i=") || !(line = num(line, &i)) || z_strcmp(line, TAIL))
+		return 0;
+	return next[w]++ == i;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *app = argc > 3 ? argv[3] : DL_APP_DEFAULT;
+	char *targv[] = { (char *)app, (char *)"x" };
+	unsigned long next[MAX_TASKS] = { 0 }, len = 0, lines = 0, errors = 0;
+	int fds[2], status = 0, done = 0;
+	ssize_t n;
+
+	g_tasks = bench_atoul(argc > 1 ? argv[1] : NULL, 8);
+	g_records = bench_atoul(argc > 2 ? argv[2] : NULL, 2000);
+	if (g_tasks > MAX_TASKS)
+		g_tasks = MAX_TASKS;
+	if (z_pipe2(fds, 0) < 0)
+		z_errx(1, "can't create pipe");
+	if (z_fork() == 0)
+	{
+		z_dup3(fds[1], 2, 0);
+		z_close(fds[0]);
+		z_close(fds[1]);
+		z_log_level = Z_LOG_INFO;
+		fdl_set_main(child_main);
+		exec_elf(app, 2, targv);
+		z_exit(1);
+	}
+	z_close(fds[1]);
+	while (len < sizeof(g_out) - 1 && (n = z_read(fds[0], g_out + len, sizeof(g_out) - 1 - len)) > 0)
+		len += n;
+	g_out[len] = 0;
+	z_wait4(-1, &status, 0, NULL);
+
+	for (char *p = g_out, *nl; *p; p = nl)
+	{
+		for (nl = p; *nl && *nl != '\n'; nl++)
+			;
+		if (*nl)
+			*nl++ = 0;
+		lines++;
+		if (!check_line(p, next, &done) && errors++ < 10)
+			z_fdprintf(2, "log_stress: bad record \"%s\"\n", p);
+	}
+	for (unsigned long w = 0; w < g_tasks; w++)
+		errors += next[w] != g_records;
+	errors += done != 1 || status != 0;
+	z_fdprintf(1, "log tasks=%lu records=%lu lines=%lu done=%d status=%d errors=%lu\n",
+			   g_tasks, g_records, lines, done, status, errors);
+	z_exit(errors ? 1 : 0);
+}
+#else
+/* SMALL builds have no log to check. */
+int main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+	z_exit(0);
+}
+#endif
@@ -0,0 +1,124 @@
+#include "bench.h"
+#include "../elf_loader.h"
+#include "../fdl_ldcache.h"
+#include "../fdl_pool.h"
+#include "../fdl_resolve.h"
+#include "../z_once.h"
+
+/* Usage: once_stress [workers] [tasks] [host program]
+ *
+ * Every task runs through the same array of fresh z_once_t while calling
+ * the lazily initialized entry points (fdl_resolve_from_maps(),
+ * fdl_default_sym(), fdl_ldcache_lookup()). Each once must run exactly
+ * once and every caller must see what it wrote, every entry point must
+ * give the same answer on every thread. Exits 1 on any mismatch. */
+
+#define DL_APP_DEFAULT "/bin/sleep"
+#define NONCE 4096
+#define SPIN 64
+
+typedef struct
+{
+	z_once_t once;
+	uint32_t runs;
+	unsigned long value;
+} cell_t;
+
+static cell_t g_cell[NONCE];
+static unsigned long g_workers, g_tasks;
+static uint32_t g_errors;
+static void *g_dlopen, *g_snprintf;
+static const char *g_libc;
+
+static void cell_init(void *arg)
+{
+	cell_t *c = arg;
+
+	__atomic_fetch_add(&c->runs, 1, __ATOMIC_RELAXED);
+	/* Widen the window for the other callers. */
+	for (int i = 0; i < SPIN; i++)
+		z_cpu_relax();
+	c->value = (unsigned long)c ^ 0x5a5a5a5aUL;
+}
+
+static void fail(void)
+{
+	__atomic_fetch_add(&g_errors, 1, __ATOMIC_RELAXED);
+}
+
+/* The first answer wins, the others must agree with it. */
+static int same_path(const char *path)
+{
+	const char *expect = NULL;
+
+	if (!path)
+		return 0;
+	return __atomic_compare_exchange_n(&g_libc, &expect, path, 0,
+									   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+		   expect == path;
+}
+
+static void task(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < NONCE; i++)
+	{
+		cell_t *c = &g_cell[i];
+
+		z_once(&c->once, cell_init, c);
+		if (c->value != ((unsigned long)c ^ 0x5a5a5a5aUL))
+			fail();
+		if ((i & 63) != 0)
+			continue;
+		if (fdl_resolve_from_maps(0) != 0 || fdl_dlopen_sym(NULL) != g_dlopen)
+			fail();
+		if (fdl_default_sym("snprintf") != g_snprintf)
+			fail();
+		if (!same_path(fdl_ldcache_lookup("libc.so.6")))
+			fail();
+	}
+}
+
+static void stress_main(void)
+{
+	unsigned long t0, runs = 0;
+	fdl_pool_t *p;
+
+	g_dlopen = fdl_dlopen_sym(NULL);
+	g_snprintf = fdl_default_sym("snprintf");
+	if (!g_dlopen || !g_snprintf)
+		z_errx(1, "can't resolve dlopen/snprintf");
+	/* The ld.so.cache is left cold, its first lookup races too. */
+	if ((p = fdl_pool_create(g_workers, FDL_POOL_PIN)) == NULL)
+		z_errx(1, "can't create pool");
+
+	t0 = bench_now_ns();
+	for (unsigned long i = 0; i < g_tasks; i++)
+		fdl_pool_submit(p, task, NULL);
+	fdl_pool_wait(p);
+	t0 = bench_now_ns() - t0;
+
+	for (int i = 0; i < NONCE; i++)
+	{
+		runs += g_cell[i].runs;
+		if (g_cell[i].runs != 1)
+			fail();
+	}
+	z_fdprintf(1, "once workers=%u tasks=%lu onces=%d runs=%lu errors=%u us=%lu\n",
+			   fdl_pool_size(p), g_tasks, NONCE, runs, g_errors,
+			   z_udivmod(t0, 1000, NULL));
+	fdl_pool_destroy(p);
+	z_exit(g_errors ? 1 : 0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *app = argc > 3 ? argv[3] : DL_APP_DEFAULT;
+	char *targv[] = { (char *)app, (char *)"x" };
+
+	g_workers = bench_atoul(argc > 1 ? argv[1] : NULL, 0);
+	g_tasks = bench_atoul(argc > 2 ? argv[2] : NULL, 64);
+	fdl_set_main(stress_main);
+	exec_elf(app, 2, targv);
+	z_exit(1);
+}
@@ -0,0 +1,52 @@
+/* A pure compute plugin for direct_bench, built with the host toolchain.
+ * It has a relocation of each kind fdl_direct.c handles: relative ones
+ * (packed into DT_RELR when the linker can), GLOB_DAT for its exported
+ * data, JUMP_SLOT for libc and for the static side's exports, and a weak
+ * import nobody provides. */
+
+#include <string.h>
+
+extern int host_add(int a, int b) __attribute__((weak));
+extern int host_missing(void) __attribute__((weak));
+
+int plugin_counter;
+static int g_ready;
+
+static int twice(int x)
+{
+	return 2 * x;
+}
+
+static int next(int x)
+{
+	return x + 1;
+}
+
+static int (*const g_ops[])(int) = { twice, next };
+static const char *const g_names[] = { "twice", "next" };
+
+__attribute__((constructor)) static void plugin_init(void)
+{
+	g_ready = 42;
+}
+
+int plugin_ready(void)
+{
+	return g_ready + (host_missing ? 1 : 0);
+}
+
+int plugin_apply(int op, int x)
+{
+	plugin_counter++;
+	return g_ops[op & 1](x);
+}
+
+unsigned long plugin_len(int op)
+{
+	return strlen(g_names[op & 1]);
+}
+
+int plugin_host(int a, int b)
+{
+	return host_add ? host_add(a, b) : -1;
+}
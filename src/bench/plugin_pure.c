@@ -0,0 +1,41 @@
+/* direct_bench's libc-free plugin, opened from main() before exec_elf()
+ * has brought up any foreign runtime. It only imports from the static
+ * side, so every import binds to the caller's exports. */
+
+extern int host_add(int a, int b);
+
+int plugin_counter;
+static int g_ready;
+
+static int twice(int x)
+{
+	return 2 * x;
+}
+
+static int next(int x)
+{
+	return x + 1;
+}
+
+static int (*const g_ops[])(int) = { twice, next };
+
+__attribute__((constructor)) static void plugin_init(void)
+{
+	g_ready = 42;
+}
+
+int plugin_ready(void)
+{
+	return g_ready;
+}
+
+int plugin_apply(int op, int x)
+{
+	plugin_counter++;
+	return g_ops[op & 1](x);
+}
+
+int plugin_host(int a, int b)
+{
+	return host_add(a, b);
+}
@@ -0,0 +1,106 @@
+#include "bench.h"
+#include "../elf_loader.h"
+#include "../fdl_resolve.h"
+#include "../fdl_pool.h"
+
+/* Usage: pool_bench [workers] [tasks] [host program]
+ *
+ * Runs the same batch of tasks calling the foreign snprintf() on a single
+ * worker and on a pinned pool, and checks every worker got its own errno,
+ * i.e. its own foreign TLS. */
+
+#define DL_APP_DEFAULT "/bin/sleep"
+#define MAX_TASKS 4096
+#define ITERS 2000
+
+typedef struct
+{
+	int *errno_loc;
+	int len;
+} task_t;
+
+static int (*f_snprintf)(char *, size_t, const char *, ...);
+static int *(*f_errno_location)(void);
+static unsigned long g_workers, g_tasks;
+static task_t g_task[MAX_TASKS];
+
+static void task(void *arg)
+{
+	task_t *t = arg;
+	char buf[64];
+
+	for (int i = 0; i < ITERS; i++)
+		t->len += f_snprintf(buf, sizeof(buf), "%d:%s:%p", i, "fdl", t);
+	t->errno_loc = f_errno_location();
+}
+
+static unsigned long run(fdl_pool_t *p)
+{
+	unsigned long i, t0;
+
+	z_memset(g_task, 0, sizeof(g_task));
+	t0 = bench_now_ns();
+	for (i = 0; i < g_tasks; i++)
+		fdl_pool_submit(p, task, &g_task[i]);
+	fdl_pool_wait(p);
+	return bench_now_ns() - t0;
+}
+
+static void pool_main(void)
+{
+	unsigned long t1, tn, i, j, ntls = 0;
+	fdl_pool_stats_t st;
+	fdl_pool_t *p;
+	/* The thread in fdl_pool_wait() helps, so one more than the workers. */
+	int *tls[FDL_POOL_MAX_WORKERS + 1];
+
+	f_snprintf = fdl_default_sym("snprintf");
+	f_errno_location = fdl_default_sym("__errno_location");
+	if (!f_snprintf || !f_errno_location)
+		z_errx(1, "can't resolve snprintf/__errno_location");
+
+	if ((p = fdl_pool_create(1, 0)) == NULL)
+		z_errx(1, "can't create pool");
+	t1 = run(p);
+	fdl_pool_destroy(p);
+
+	if ((p = fdl_pool_create(g_workers, FDL_POOL_PIN)) == NULL)
+		z_errx(1, "can't create pool");
+	tn = run(p);
+
+	/* Tasks run by the same thread share an errno, count distinct ones. */
+	for (i = 0; i < g_tasks; i++)
+	{
+		for (j = 0; j < ntls && tls[j] != g_task[i].errno_loc; j++)
+			;
+		if (j == ntls && ntls < FDL_POOL_MAX_WORKERS + 1)
+			tls[ntls++] = g_task[i].errno_loc;
+	}
+
+	z_fdprintf(1, "pool workers=%u tasks=%lu iters=%d single_us=%lu pool_us=%lu "
+				  "speedup_x100=%lu tls_slots=%lu\n",
+			   fdl_pool_size(p), g_tasks, ITERS, z_udivmod(t1, 1000, NULL),
+			   z_udivmod(tn, 1000, NULL), z_udivmod(t1 * 100, tn, NULL), ntls);
+	for (i = 0; i < fdl_pool_size(p); i++)
+	{
+		fdl_pool_stats(p, i, &st);
+		z_fdprintf(1, "pool worker=%lu executed=%lu stolen=%lu\n",
+				   i, st.executed, st.stolen);
+	}
+	fdl_pool_destroy(p);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *app = argc > 3 ? argv[3] : DL_APP_DEFAULT;
+	char *targv[] = { (char *)app, (char *)"x" };
+
+	g_workers = bench_atoul(argc > 1 ? argv[1] : NULL, 0);
+	g_tasks = bench_atoul(argc > 2 ? argv[2] : NULL, 1024);
+	if (g_tasks > MAX_TASKS)
+		g_tasks = MAX_TASKS;
+
+	fdl_set_main(pool_main);
+	exec_elf(app, 2, targv);
+	z_exit(1);
+}
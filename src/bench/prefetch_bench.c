@@ -0,0 +1,27 @@
+#include "bench.h"
+#include "../fdl_prefetch.h"
+
+/* Usage: prefetch_bench library [...]
+ *
+ * Prints the load-order manifest of every library and the time the
+ * static-side walk and readahead took. Needs no foreign runtime. */
+
+static fdl_manifest_t g_manifest;
+
+int main(int argc, char *argv[])
+{
+	unsigned long t0;
+	int i, j, n;
+
+	for (i = 1; i < argc; i++)
+	{
+		t0 = bench_now_ns();
+		n = fdl_prefetch(argv[i], &g_manifest);
+		t0 = bench_now_ns() - t0;
+		z_fdprintf(1, "prefetch lib=%s files=%d us=%lu\n", argv[i], n,
+				   z_udivmod(t0, 1000, NULL));
+		for (j = 0; j < n; j++)
+			z_fdprintf(1, "  %d %s\n", j, g_manifest.path[j]);
+	}
+	z_exit(0);
+}
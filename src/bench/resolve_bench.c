@@ -0,0 +1,355 @@
+#include "bench.h"
+#include "../fdl_resolve.h"
+
+#include <dirent.h>
+
+/* Usage: resolve_bench [rounds] [dir ...]
+ *
+ * Lays out every ELF shared object under the dirs (/usr/lib and /lib by
+ * default) the way ld.so would, runs fdl_mod_init() on it and checks
+ * fdl_lookup_gnu(), fdl_lookup_sysv() and fdl_resolve_sym() against a plain
+ * walk of its .dynsym: every exported symbol must be found, imports and
+ * names that are not there must not. Then times hit and miss lookups through
+ * fdl_resolve_sym(), per kind of hash table. Exits 1 on a mismatch. */
+
+#define PAGE_SIZE 4096
+#define ALIGN (PAGE_SIZE - 1)
+#define MAX_PHDR 32
+#define MAX_DEPTH 8
+#define MAX_SYMS 65536
+#define MISS_BUF (1 << 20)
+#define SEEN_SIZE 65536 /* power of two */
+
+enum
+{
+	KIND_GNU,
+	KIND_SYSV,
+	KIND_MIXED,
+	NKIND
+};
+
+typedef struct
+{
+	unsigned long libs, syms;
+	unsigned long hits, hit_ns;
+	unsigned long misses, miss_ns;
+} kind_stat_t;
+
+struct linux_dirent64
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static const char *const g_kind[NKIND] = { "gnu", "sysv", "mixed" };
+static kind_stat_t g_stat[NKIND];
+static unsigned long g_rounds, g_errors, g_skipped;
+static uint64_t g_seen[SEEN_SIZE];
+static const char *g_names[MAX_SYMS];
+static char g_miss[MISS_BUF];
+static const char *g_misses[MAX_SYMS];
+static volatile unsigned long g_sink;
+
+static void check(const char *path, const char *what, const char *name, int ok)
+{
+	if (!ok && g_errors++ < 10)
+		z_fdprintf(2, "resolve mismatch: %s %s %s\n", path, what, name);
+}
+
+/* 0 if this inode was already checked, /lib may well be /usr/lib. */
+static int first_seen(uint64_t ino)
+{
+	unsigned long i = (unsigned long)(ino * 0x9e3779b97f4a7c15ULL) & (SEEN_SIZE - 1);
+
+	for (unsigned long n = 0; n < SEEN_SIZE; n++, i = (i + 1) & (SEEN_SIZE - 1))
+	{
+		if (g_seen[i] == ino + 1)
+			return 0;
+		if (!g_seen[i])
+		{
+			g_seen[i] = ino + 1;
+			return 1;
+		}
+	}
+	return 1;
+}
+
+/* foo.so or foo.so.1.2 */
+static int is_so(const char *name)
+{
+	const char *p = name;
+
+	while ((p = z_strstr(p, ".so")) != NULL)
+	{
+		if (p[3] == 0 || p[3] == '.')
+			return 1;
+		p += 3;
+	}
+	return 0;
+}
+
+/* Map the PT_LOADs read only at their vaddr from a fresh base, the file
+ * as far as p_filesz goes. Returns the base, 0 if it isn't one of ours. */
+static unsigned long map_object(const char *path, unsigned long *span)
+{
+	Elf_Ehdr eh;
+	Elf_Phdr ph[MAX_PHDR];
+	unsigned long end = 0, size;
+	unsigned char *base;
+	int fd, i, ok;
+
+	if ((fd = z_open(path, O_RDONLY)) < 0)
+		return 0;
+	ok = z_read(fd, &eh, sizeof(eh)) == sizeof(eh) &&
+		 eh.e_ident[EI_MAG0] == ELFMAG0 && eh.e_ident[EI_MAG1] == ELFMAG1 &&
+		 eh.e_ident[EI_MAG2] == ELFMAG2 && eh.e_ident[EI_MAG3] == ELFMAG3 &&
+		 eh.e_ident[EI_CLASS] == ELFCLASS && eh.e_machine == Z_EM &&
+		 eh.e_type == ET_DYN && eh.e_phentsize == sizeof(Elf_Phdr) &&
+		 eh.e_phnum <= MAX_PHDR;
+	ok = ok && z_lseek(fd, eh.e_phoff, SEEK_SET) == (int)eh.e_phoff &&
+		 z_read(fd, ph, eh.e_phnum * sizeof(Elf_Phdr)) == (ssize_t)(eh.e_phnum * sizeof(Elf_Phdr));
+	size = (unsigned long)z_lseek(fd, 0, SEEK_END);
+	for (i = 0; ok && i < eh.e_phnum; i++)
+	{
+		if (ph[i].p_type != PT_LOAD)
+			continue;
+		if (ph[i].p_offset + ph[i].p_filesz > size)
+			ok = 0;
+		if (ph[i].p_vaddr + ph[i].p_memsz > end)
+			end = ph[i].p_vaddr + ph[i].p_memsz;
+	}
+	if (!ok || !end)
+	{
+		z_close(fd);
+		return 0;
+	}
+
+	*span = (end + ALIGN) & ~ALIGN;
+	base = z_mmap(NULL, *span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	for (i = 0; base != (void *)-1 && i < eh.e_phnum; i++)
+	{
+		unsigned long va = ph[i].p_vaddr & ~ALIGN;
+		unsigned long len = ph[i].p_filesz + (ph[i].p_vaddr & ALIGN);
+
+		if (ph[i].p_type != PT_LOAD || !ph[i].p_filesz)
+			continue;
+		if (z_mmap(base + va, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd,
+				   ph[i].p_offset & ~ALIGN) == (void *)-1)
+		{
+			z_munmap(base, *span);
+			base = (void *)-1;
+		}
+	}
+	z_close(fd);
+	return base == (void *)-1 ? 0 : (unsigned long)base;
+}
+
+/* Entries in .dynsym: nchain, or past the last GNU hash chain. */
+static unsigned long sym_count(fdl_mod_t *m)
+{
+	unsigned long n = 0;
+
+	if (m->buckets)
+		return m->nchain;
+	if (!m->gnu_buckets)
+		return 0;
+	for (uint32_t i = 0; i < m->gnu_nbucket; i++)
+		if (m->gnu_buckets[i] > n)
+			n = m->gnu_buckets[i];
+	if (n < m->gnu_symoffset)
+		return m->gnu_symoffset;
+	while (!(m->gnu_chain[n - m->gnu_symoffset] & 1))
+		n++;
+	return n + 1;
+}
+
+static int exported(const Elf_Sym *s)
+{
+	return s->st_name && s->st_shndx != SHN_UNDEF && ELF_ST_BIND(s->st_info) != STB_LOCAL;
+}
+
+static int found(fdl_mod_t *m, const Elf_Sym *r, const char *name)
+{
+	return r && r->st_shndx != SHN_UNDEF && !z_strcmp(m->dynstr + r->st_name, name);
+}
+
+static int is_func(const Elf_Sym *s)
+{
+	return ELF_ST_TYPE(s->st_info) == STT_FUNC || ELF_ST_TYPE(s->st_info) == STT_GNU_IFUNC;
+}
+
+static unsigned long time_lookups(fdl_mod_t *m, const char *const *names, unsigned long n)
+{
+	unsigned long t0 = bench_now_ns(), sink = 0;
+
+	for (unsigned long r = 0; r < g_rounds; r++)
+		for (unsigned long i = 0; i < n; i++)
+			sink += (unsigned long)fdl_resolve_sym(m, names[i]);
+	g_sink = sink;
+	return bench_now_ns() - t0;
+}
+
+static void check_object(const char *path)
+{
+	unsigned long base, span, nsym, nname = 0, nmiss = 0, used = 0;
+	kind_stat_t *st;
+	fdl_mod_t m;
+
+	if ((base = map_object(path, &span)) == 0)
+		return;
+	z_memset(&m, 0, sizeof(m));
+	if (fdl_mod_init(&m, base) < 0 || (!m.gnu_buckets && !m.buckets))
+	{
+		g_skipped++;
+		z_munmap((void *)base, span);
+		return;
+	}
+	st = &g_stat[m.gnu_buckets ? (m.buckets ? KIND_MIXED : KIND_GNU) : KIND_SYSV];
+	nsym = sym_count(&m);
+
+	for (unsigned long i = 1; i < nsym; i++)
+	{
+		const Elf_Sym *s = &m.dynsym[i];
+		const char *name = m.dynstr + s->st_name;
+		const Elf_Sym *r;
+		void *f;
+		size_t len;
+
+		/* Imports never resolve, ld.so skips them too. The same name may
+		 * still be exported under another version. */
+		if (s->st_name && s->st_shndx == SHN_UNDEF)
+		{
+			r = fdl_lookup_gnu(&m, name);
+			check(path, "gnu import", name, !r || found(&m, r, name));
+			r = fdl_lookup_sysv(&m, name);
+			check(path, "sysv import", name, !r || found(&m, r, name));
+			check(path, "resolve import", name, fdl_resolve_sym(&m, name) != (void *)base);
+			continue;
+		}
+		if (!exported(s))
+			continue;
+		if (m.gnu_buckets)
+			check(path, "gnu", name, found(&m, fdl_lookup_gnu(&m, name), name));
+		if (m.buckets)
+			check(path, "sysv", name, found(&m, fdl_lookup_sysv(&m, name), name));
+		r = m.gnu_buckets ? fdl_lookup_gnu(&m, name) : fdl_lookup_sysv(&m, name);
+		f = fdl_resolve_sym(&m, name);
+		if (r && is_func(r))
+			check(path, "resolve", name, f == (void *)(base + r->st_value) && (unsigned long)f - base < span);
+		else
+			check(path, "resolve", name, f == NULL);
+		if (nname < MAX_SYMS)
+			g_names[nname++] = name;
+
+		/* '@' never makes it into .dynstr, versions live elsewhere. */
+		for (len = 0; name[len]; len++)
+			;
+		if (nmiss < MAX_SYMS && used + len + 2 <= MISS_BUF)
+		{
+			char *miss = g_miss + used;
+
+			z_memcpy(miss, name, len);
+			miss[len] = '@';
+			miss[len + 1] = 0;
+			used += len + 2;
+			g_misses[nmiss++] = miss;
+			check(path, "gnu miss", miss, !fdl_lookup_gnu(&m, miss));
+			check(path, "sysv miss", miss, !fdl_lookup_sysv(&m, miss));
+		}
+	}
+
+	st->libs++;
+	st->syms += nname;
+	st->hit_ns += time_lookups(&m, g_names, nname);
+	st->hits += nname * g_rounds;
+	st->miss_ns += time_lookups(&m, g_misses, nmiss);
+	st->misses += nmiss * g_rounds;
+	z_munmap((void *)base, span);
+}
+
+static void walk(const char *dir, int depth)
+{
+	char buf[4096], path[512];
+	long n;
+	int fd;
+
+	if ((fd = z_open(dir, O_RDONLY | O_DIRECTORY)) < 0)
+		return;
+	while ((n = z_getdents64(fd, buf, sizeof(buf))) > 0)
+	{
+		for (long off = 0; off < n;)
+		{
+			struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+			const char *s = d->d_name;
+			size_t i = 0;
+
+			off += d->d_reclen;
+			if (s[0] == '.' && (!s[1] || (s[1] == '.' && !s[2])))
+				continue;
+			/* Links are skipped, their targets are in the tree too. */
+			if (d->d_type != DT_DIR && (d->d_type != DT_REG || !is_so(s)))
+				continue;
+			for (const char *p = dir; *p && i < sizeof(path) - 2; p++)
+				path[i++] = *p;
+			if (i && path[i - 1] != '/')
+				path[i++] = '/';
+			for (; *s && i < sizeof(path) - 1; s++)
+				path[i++] = *s;
+			path[i] = 0;
+			if (*s)
+				continue;
+			if (d->d_type == DT_DIR)
+			{
+				if (depth < MAX_DEPTH)
+					walk(path, depth + 1);
+			}
+			else if (first_seen(d->d_ino))
+			{
+				check_object(path);
+			}
+		}
+	}
+	z_close(fd);
+}
+
+/* Lookups per second, or 0 with nothing timed. */
+static unsigned long per_sec(unsigned long n, unsigned long ns)
+{
+	unsigned long us = ns / 1000;
+
+	return us ? z_udivmod(n * 1000000, us, NULL) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long libs = 0, syms = 0;
+
+	g_rounds = bench_atoul(argc > 1 ? argv[1] : NULL, 3);
+	if (argc > 2)
+	{
+		for (int i = 2; i < argc; i++)
+			walk(argv[i], 0);
+	}
+	else
+	{
+		walk("/usr/lib", 0);
+		walk("/lib", 0);
+	}
+
+	for (int k = 0; k < NKIND; k++)
+	{
+		kind_stat_t *st = &g_stat[k];
+
+		libs += st->libs;
+		syms += st->syms;
+		z_fdprintf(1, "resolve hash=%s libs=%lu syms=%lu hit_per_s=%lu miss_per_s=%lu\n",
+				   g_kind[k], st->libs, st->syms,
+				   per_sec(st->hits, st->hit_ns), per_sec(st->misses, st->miss_ns));
+	}
+	z_fdprintf(1, "resolve libs=%lu syms=%lu skipped=%lu rounds=%lu errors=%lu\n",
+			   libs, syms, g_skipped, g_rounds, g_errors);
+	z_exit(g_errors ? 1 : 0);
+}
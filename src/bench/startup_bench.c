@@ -0,0 +1,205 @@
+#include "bench.h"
+
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* Usage: startup_bench [runs] [host program]
+ *
+ * Starts every variant below, found next to this binary, [runs] times,
+ * round robin, and prints one line per variant: percentiles of the time
+ * from fork to the first foreign call having returned, of the peak RSS and
+ * of the minor faults, then the syscalls made from the execve on (one more
+ * run, as a ptrace tracer). The fdl variants load the host program and so
+ * its interpreter, the native one gets the default interpreter itself. */
+
+#define DL_APP_DEFAULT "/bin/sleep"
+#define MAX_RUNS 1000
+#define MAX_ENV 256
+#define BENCH_FD 9
+#define NVARIANT (sizeof(g_variants) / sizeof(g_variants[0]))
+
+typedef struct
+{
+	const char *name;
+	const char *file;
+	int host; /* takes the host program as argv[1] */
+} variant_t;
+
+static const variant_t g_variants[] = {
+	{ "fdl", "startup_fdl", 1 },
+	{ "small", "startup_small", 1 },
+	{ "native", "startup_native", 0 },
+};
+
+static unsigned long g_ttfc[NVARIANT][MAX_RUNS];
+static unsigned long g_rss[NVARIANT][MAX_RUNS];
+static unsigned long g_minflt[NVARIANT][MAX_RUNS];
+static unsigned long g_ok[NVARIANT];
+static char g_path[NVARIANT][256];
+static char *g_envp[MAX_ENV + 2];
+
+/* Our environment, with FDL_BENCH_FD pointing at the report pipe. */
+static void make_env(void)
+{
+	static char fd_var[] = "FDL_BENCH_FD=9"; /* BENCH_FD */
+	int n = 0;
+
+	for (char **e = z_environ; e && *e && n < MAX_ENV; e++)
+		if (z_memcmp(*e, "FDL_BENCH_FD=", 13))
+			g_envp[n++] = *e;
+	g_envp[n++] = fd_var;
+	g_envp[n] = NULL;
+}
+
+static void make_path(char *out, const char *self, const char *file)
+{
+	const char *slash = NULL;
+	size_t n = 0;
+
+	for (const char *p = self; *p; p++)
+		if (*p == '/')
+			slash = p;
+	for (const char *p = self; slash && p <= slash && n < 200; p++)
+		out[n++] = *p;
+	for (; *file && n < 255; file++)
+		out[n++] = *file;
+	out[n] = 0;
+}
+
+static __attribute__((noreturn)) void child(const char *path, char *const argv[],
+											int fd, int traced)
+{
+	if (fd != BENCH_FD)
+	{
+		z_dup3(fd, BENCH_FD, 0);
+		z_close(fd);
+	}
+	if (traced)
+		z_ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+	z_execve(path, argv, g_envp);
+	z_exit(127);
+	__builtin_unreachable();
+}
+
+/* One timed run, 0 if the child didn't get to its first foreign call. */
+static int run(const char *path, char *const argv[], unsigned long *ttfc,
+			   struct rusage *ru)
+{
+	unsigned long t0, t1 = 0;
+	int fds[2], status = -1;
+	ssize_t n;
+	pid_t pid;
+
+	if (z_pipe2(fds, 0) < 0)
+		return 0;
+	t0 = bench_now_ns();
+	if ((pid = z_fork()) == 0)
+	{
+		z_close(fds[0]);
+		child(path, argv, fds[1], 0);
+	}
+	z_close(fds[1]);
+	n = z_read(fds[0], &t1, sizeof(t1));
+	z_close(fds[0]);
+	if (pid < 0 || z_wait4(pid, &status, 0, ru) != pid)
+		return 0;
+	*ttfc = t1 - t0;
+	return n == sizeof(t1) && t1 > t0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Syscalls from the execve on, as seen by a tracer. */
+static unsigned long count_syscalls(const char *path, char *const argv[])
+{
+	unsigned long stops = 0;
+	int fds[2], status, sig = 0;
+	pid_t pid;
+
+	if (z_pipe2(fds, 0) < 0)
+		return 0;
+	if ((pid = z_fork()) == 0)
+	{
+		z_close(fds[0]);
+		child(path, argv, fds[1], 1);
+	}
+	z_close(fds[1]);
+	/* The first stop is the SIGTRAP of its execve. */
+	if (pid > 0 && z_wait4(pid, &status, 0, NULL) == pid && WIFSTOPPED(status))
+	{
+		z_ptrace(PTRACE_SETOPTIONS, pid, NULL,
+				 (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+		while (z_ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig) == 0 &&
+			   z_wait4(pid, &status, 0, NULL) == pid && WIFSTOPPED(status))
+		{
+			sig = WSTOPSIG(status);
+			if (sig == (SIGTRAP | 0x80))
+			{
+				stops++;
+				sig = 0;
+			}
+		}
+	}
+	/* The report pipe stays open until the child is gone, no SIGPIPE. */
+	z_close(fds[0]);
+	/* An entry and an exit stop each, exit_group only has the first. */
+	return (stops + 1) >> 1;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long runs = bench_atoul(argc > 1 ? argv[1] : NULL, 100);
+	const char *app = argc > 2 ? argv[2] : DL_APP_DEFAULT;
+	char *vargv[NVARIANT][3];
+	struct rusage ru;
+	unsigned long i, v, ttfc;
+
+	if (runs == 0 || runs > MAX_RUNS)
+		runs = MAX_RUNS;
+	make_env();
+	for (v = 0; v < NVARIANT; v++)
+	{
+		make_path(g_path[v], argv[0], g_variants[v].file);
+		vargv[v][0] = g_path[v];
+		vargv[v][1] = g_variants[v].host ? (char *)app : NULL;
+		vargv[v][2] = NULL;
+		/* Untimed, warms the page cache. */
+		run(g_path[v], vargv[v], &ttfc, &ru);
+	}
+
+	/* Round robin, so drift hits every variant the same. */
+	for (i = 0; i < runs; i++)
+	{
+		for (v = 0; v < NVARIANT; v++)
+		{
+			unsigned long k = g_ok[v];
+
+			z_memset(&ru, 0, sizeof(ru));
+			if (!run(g_path[v], vargv[v], &g_ttfc[v][k], &ru))
+				continue;
+			g_rss[v][k] = ru.ru_maxrss;
+			g_minflt[v][k] = ru.ru_minflt;
+			g_ok[v]++;
+		}
+	}
+
+	z_fdprintf(1, "startup host=%s runs=%lu\n", app, runs);
+	for (v = 0; v < NVARIANT; v++)
+	{
+		unsigned long n = g_ok[v], *t = g_ttfc[v], *r = g_rss[v], *f = g_minflt[v];
+
+		bench_sort(t, n);
+		bench_sort(r, n);
+		bench_sort(f, n);
+		z_fdprintf(1, "startup variant=%s ok=%lu failed=%lu"
+					  " ttfc_ns_p50=%lu ttfc_ns_p90=%lu ttfc_ns_p99=%lu"
+					  " rss_kb_p50=%lu rss_kb_p99=%lu"
+					  " minflt_p50=%lu minflt_p99=%lu syscalls=%lu\n",
+				   g_variants[v].name, n, runs - n,
+				   bench_pct(t, n, 50), bench_pct(t, n, 90), bench_pct(t, n, 99),
+				   bench_pct(r, n, 50), bench_pct(r, n, 99),
+				   bench_pct(f, n, 50), bench_pct(f, n, 99),
+				   n ? count_syscalls(g_path[v], vargv[v]) : 0);
+	}
+	z_exit(0);
+}
@@ -0,0 +1,36 @@
+#include "bench.h"
+#include "../elf_loader.h"
+#include "../fdl_resolve.h"
+
+/* Usage: startup_fdl [host program]
+ *
+ * The static side of startup_bench, also built as startup_small. Loads the
+ * host program, makes the first foreign call from the fdl_set_main() hook
+ * and writes the CLOCK_MONOTONIC time it returned at, in ns, to the fd in
+ * FDL_BENCH_FD. startup_native.c does the same with the native linker. */
+
+#define DL_APP_DEFAULT "/bin/sleep"
+
+static void first_call(void)
+{
+	pid_t (*getpid_fn)(void) = (pid_t (*)(void))fdl_default_sym("getpid");
+	const char *fd = z_getenv("FDL_BENCH_FD");
+	unsigned long now;
+
+	if (!getpid_fn || getpid_fn() <= 0)
+		z_exit(1);
+	now = bench_now_ns();
+	if (fd)
+		z_write(bench_atoul(fd, 0), &now, sizeof(now));
+	z_exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *app = argc > 1 ? argv[1] : DL_APP_DEFAULT;
+	char *targv[] = { (char *)app, (char *)"x" };
+
+	fdl_set_main(first_call);
+	exec_elf(app, 2, targv);
+	z_exit(1);
+}
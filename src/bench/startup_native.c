@@ -0,0 +1,27 @@
+/* The dynamically linked baseline of startup_bench, built with the host
+ * toolchain and libc. Same first foreign call and report as startup_fdl.c,
+ * with ld.so doing all of the work. */
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(void)
+{
+	pid_t (*getpid_fn)(void);
+	const char *fd = getenv("FDL_BENCH_FD");
+	struct timespec ts;
+	unsigned long now;
+	void *h;
+
+	if ((h = dlopen(NULL, RTLD_NOW)) == NULL ||
+		(getpid_fn = (pid_t (*)(void))dlsym(h, "getpid")) == NULL ||
+		getpid_fn() <= 0)
+		_exit(1);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+	if (fd && write(atoi(fd), &now, sizeof(now)) != sizeof(now))
+		_exit(1);
+	_exit(0);
+}
@@ -0,0 +1,121 @@
+#include "bench.h"
+#include "../elf_loader.h"
+#include "../fdl_resolve.h"
+#include "../z_thunk.h"
+
+/* Usage: thunk_bench [elements] [host program]
+ *
+ * Once the foreign runtime is up, sorts [elements] (10M by default) random
+ * ints with the foreign qsort() three ways: with a plain static comparator,
+ * through a z_thunk comparator that counts its calls in ctx, and with the
+ * foreign qsort_r() passing the same ctx. Prints the time of each and exits
+ * 1 if a result is not sorted. */
+
+#define DL_APP_DEFAULT "/bin/sleep"
+
+typedef int (*cmp_fn_t)(const void *, const void *);
+typedef void (*qsort_fn_t)(void *, size_t, size_t, cmp_fn_t);
+typedef void (*qsort_r_fn_t)(void *, size_t, size_t,
+							 int (*)(const void *, const void *, void *), void *);
+
+static unsigned long g_count, g_errors;
+static unsigned int *g_src, *g_buf;
+
+static int cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+static int cmp_ctx(void *ctx, const void *a, const void *b)
+{
+	++*(unsigned long *)ctx;
+	return cmp(a, b);
+}
+
+static int cmp_r(const void *a, const void *b, void *ctx)
+{
+	++*(unsigned long *)ctx;
+	return cmp(a, b);
+}
+
+static void check_sorted(const char *what)
+{
+	for (unsigned long i = 1; i < g_count; i++)
+	{
+		if (g_buf[i - 1] > g_buf[i])
+		{
+			g_errors++;
+			z_fdprintf(2, "thunk: %s result not sorted at %lu\n", what, i);
+			return;
+		}
+	}
+}
+
+static void bench_main(void)
+{
+	qsort_fn_t my_qsort = (qsort_fn_t)fdl_default_sym("qsort");
+	qsort_r_fn_t my_qsort_r = (qsort_r_fn_t)fdl_default_sym("qsort_r");
+	unsigned long plain, thunked, calls = 0, r_ns = 0, r_calls = 0, t0;
+	cmp_fn_t thunk;
+
+	if (!my_qsort)
+		z_errx(1, "no qsort in the foreign libc");
+	if ((thunk = (cmp_fn_t)z_thunk_new((void *)cmp_ctx, &calls)) == NULL)
+		z_errx(1, "can't make a thunk");
+
+	z_memcpy(g_buf, g_src, g_count * sizeof(*g_buf));
+	t0 = bench_now_ns();
+	my_qsort(g_buf, g_count, sizeof(*g_buf), cmp);
+	plain = bench_now_ns() - t0;
+	check_sorted("plain");
+
+	z_memcpy(g_buf, g_src, g_count * sizeof(*g_buf));
+	t0 = bench_now_ns();
+	my_qsort(g_buf, g_count, sizeof(*g_buf), thunk);
+	thunked = bench_now_ns() - t0;
+	check_sorted("thunk");
+
+	if (my_qsort_r)
+	{
+		z_memcpy(g_buf, g_src, g_count * sizeof(*g_buf));
+		t0 = bench_now_ns();
+		my_qsort_r(g_buf, g_count, sizeof(*g_buf), cmp_r, &r_calls);
+		r_ns = bench_now_ns() - t0;
+		check_sorted("qsort_r");
+	}
+	z_thunk_free((void *)thunk);
+
+	z_fdprintf(1, "thunk elements=%lu compares=%lu plain_ms=%lu thunk_ms=%lu"
+				  " qsort_r_ms=%lu qsort_r_compares=%lu errors=%lu\n",
+			   g_count, calls, plain / 1000000, thunked / 1000000,
+			   r_ns / 1000000, r_calls, g_errors);
+	z_exit(g_errors ? 1 : 0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *app = argc > 2 ? argv[2] : DL_APP_DEFAULT;
+	char *targv[] = { (char *)app, (char *)"x" };
+	unsigned long seed = 88172645463325252UL;
+	size_t len;
+
+	g_count = bench_atoul(argc > 1 ? argv[1] : NULL, 10000000);
+	len = g_count * sizeof(*g_src);
+	g_src = z_mmap(NULL, 2 * len + 1, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (g_src == (void *)-1)
+		z_errx(1, "can't map %lu elements", g_count);
+	g_buf = g_src + g_count;
+	for (unsigned long i = 0; i < g_count; i++)
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		g_src[i] = (unsigned int)seed;
+	}
+
+	fdl_set_main(bench_main);
+	exec_elf(app, 2, targv);
+	z_exit(1);
+}
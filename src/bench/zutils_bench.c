@@ -0,0 +1,280 @@
+#include "bench.h"
+
+/* Usage: zutils_bench [rounds]
+ *
+ * Checks z_memcpy/z_memset/z_strcmp/z_strstr against byte loops over every
+ * small size and alignment, with and without the vector paths, then times
+ * the byte loops, the word paths (z_simd = 0) and the vector paths.
+ * Exits 1 on a mismatch. */
+
+#define BUF 65536
+#define PAD 64
+
+static unsigned char g_a[BUF + PAD], g_b[BUF + PAD], g_c[BUF + PAD];
+static char g_maps[BUF];
+static unsigned long g_seed = 88172645463325252UL;
+static unsigned long g_errors;
+
+static unsigned long rnd(void)
+{
+	g_seed ^= g_seed << 13;
+	g_seed ^= g_seed >> 7;
+	g_seed ^= g_seed << 17;
+	return g_seed;
+}
+
+static __attribute__((noinline)) void *ref_memcpy(void *d, const void *s, size_t n)
+{
+	unsigned char *p = d;
+	const unsigned char *q = s;
+	while (n--)
+		*p++ = *q++;
+	return d;
+}
+
+static __attribute__((noinline)) void *ref_memset(void *d, int c, size_t n)
+{
+	unsigned char *p = d;
+	while (n--)
+		*p++ = c;
+	return d;
+}
+
+static __attribute__((noinline)) int ref_strcmp(const char *a, const char *b)
+{
+	while (*a && *a == *b)
+	{
+		a++;
+		b++;
+	}
+	return (unsigned char)*a - (unsigned char)*b;
+}
+
+static __attribute__((noinline)) char *ref_strstr(const char *h, const char *n)
+{
+	for (; *h; h++)
+	{
+		const char *p = h, *q = n;
+		while (*q && *p == *q)
+		{
+			p++;
+			q++;
+		}
+		if (!*q)
+			return (char *)h;
+	}
+	return *n ? NULL : (char *)h;
+}
+
+static unsigned long umod(unsigned long n, unsigned long d)
+{
+	unsigned long rem;
+
+	z_udivmod(n, d, &rem);
+	return rem;
+}
+
+static int sign(int v)
+{
+	return (v > 0) - (v < 0);
+}
+
+static void check(const char *what, int ok)
+{
+	if (!ok && g_errors++ < 10)
+		z_fdprintf(2, "zutils mismatch: %s simd=%d\n", what, z_simd);
+}
+
+static void verify(void)
+{
+	size_t n, i;
+	int da, sa;
+
+	for (n = 0; n < 300; n++)
+	{
+		for (da = 0; da < 16; da++)
+		{
+			for (sa = 0; sa < 16; sa++)
+			{
+				for (i = 0; i < n + 2 * PAD && i < sizeof(g_a); i++)
+					g_a[i] = rnd(), g_b[i] = g_c[i] = rnd();
+				z_memcpy(g_b + da, g_a + sa, n);
+				ref_memcpy(g_c + da, g_a + sa, n);
+				check("memcpy", !z_memcmp(g_b, g_c, n + PAD));
+			}
+			z_memset(g_b + da, da * 7, n);
+			ref_memset(g_c + da, da * 7, n);
+			check("memset", !z_memcmp(g_b, g_c, n + PAD));
+		}
+	}
+
+	/* Strings sharing long prefixes, at every relative alignment. */
+	for (i = 0; i < 20000; i++)
+	{
+		char *a = (char *)g_a + (rnd() & 31), *b = (char *)g_b + (rnd() & 31);
+		size_t la = rnd() & 127, lb = rnd() & 1 ? la : rnd() & 127, k;
+
+		for (k = 0; k < la; k++)
+			a[k] = 'a' + (rnd() & 1 ? 0 : k & 3);
+		for (k = 0; k < lb; k++)
+			b[k] = k < la && (rnd() & 63) ? a[k] : (char)('a' + (k & 3));
+		a[la] = b[lb] = 0;
+		if (rnd() & 1)
+			a[la ? la - 1 : 0] = (char)0xe9; /* sign of non-ASCII bytes */
+		check("strcmp", sign(z_strcmp(a, b)) == sign(ref_strcmp(a, b)));
+		b[umod(rnd(), lb + 1)] = 0;
+		check("strstr", z_strstr(a, b) == ref_strstr(a, b));
+	}
+}
+
+static void verify_strstr(void)
+{
+	char needle[9];
+	size_t len;
+
+	for (len = 0; g_maps[len]; len++)
+		;
+	for (int i = 0; i < 2000 && len > 8; i++)
+	{
+		size_t at = umod(rnd(), len - 8), nl = 1 + (rnd() & 7), k;
+		const char *h = g_maps + (rnd() & 15);
+
+		for (k = 0; k < nl && g_maps[at + k]; k++)
+			needle[k] = g_maps[at + k];
+		needle[k] = 0;
+		if (rnd() & 3)
+			needle[umod(rnd(), k + 1)] = 'Q';
+		check("strstr", z_strstr(h, needle) == ref_strstr(h, needle));
+	}
+}
+
+static unsigned long time_copy(int mode, size_t n, unsigned long rounds)
+{
+	unsigned long t0 = bench_now_ns();
+
+	for (unsigned long r = 0; r < rounds; r++)
+	{
+		if (mode < 0)
+			ref_memcpy(g_b + (r & 7), g_a, n);
+		else
+			z_memcpy(g_b + (r & 7), g_a, n);
+	}
+	return bench_now_ns() - t0;
+}
+
+static unsigned long time_set(int mode, size_t n, unsigned long rounds)
+{
+	unsigned long t0 = bench_now_ns();
+
+	for (unsigned long r = 0; r < rounds; r++)
+	{
+		if (mode < 0)
+			ref_memset(g_b + (r & 7), r, n);
+		else
+			z_memset(g_b + (r & 7), r, n);
+	}
+	return bench_now_ns() - t0;
+}
+
+static unsigned long time_strcmp(int mode, unsigned long rounds)
+{
+	static const char *names[] = {
+		"__libc_dlopen_mode", "__libc_dlsym", "__libc_start_main",
+		"_dl_catch_exception", "__libc_dlclose", "pthread_create",
+	};
+	unsigned long t0 = bench_now_ns(), hits = 0;
+
+	for (unsigned long r = 0; r < rounds; r++)
+		for (int i = 0; i < 6; i++)
+			hits += (mode < 0 ? ref_strcmp(names[0], names[i])
+							  : z_strcmp(names[0], names[i])) == 0;
+	return hits ? bench_now_ns() - t0 : 0;
+}
+
+static unsigned long time_strstr(int mode, unsigned long rounds)
+{
+	unsigned long t0 = bench_now_ns(), hits = 0;
+
+	for (unsigned long r = 0; r < rounds; r++)
+		hits += (mode < 0 ? ref_strstr(g_maps, "libnot-there")
+						  : z_strstr(g_maps, "libnot-there")) != NULL;
+	return hits ? 0 : bench_now_ns() - t0;
+}
+
+/* Per operation, in ns times 100. */
+static unsigned long per_op(unsigned long ns, unsigned long ops)
+{
+	return z_udivmod(ns * 100, ops, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t sizes[] = { 16, 64, 256, 4096, 65536 };
+	unsigned long rounds = bench_atoul(argc > 1 ? argv[1] : NULL, 1 << 24);
+	int have_simd = z_simd, fd;
+	unsigned long maps_len = 0;
+	ssize_t n;
+
+	if ((fd = z_open("/proc/self/maps", O_RDONLY)) >= 0)
+	{
+		n = z_read(fd, g_maps, sizeof(g_maps) - 1);
+		maps_len = n > 0 ? n : 0;
+		g_maps[maps_len] = 0;
+		z_close(fd);
+	}
+
+	for (z_simd = 0; z_simd <= have_simd; z_simd++)
+	{
+		verify();
+		verify_strstr();
+	}
+	z_simd = have_simd;
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		size_t sz = sizes[i];
+		unsigned long r = z_udivmod(rounds, sz, NULL) + 1000;
+		unsigned long b, w, v;
+
+		b = time_copy(-1, sz, r);
+		z_simd = 0;
+		w = time_copy(0, sz, r);
+		z_simd = have_simd;
+		v = time_copy(0, sz, r);
+		z_fdprintf(1, "zutils op=memcpy size=%lu byte_ns100=%lu word_ns100=%lu simd_ns100=%lu\n",
+				   (unsigned long)sz, per_op(b, r), per_op(w, r), per_op(v, r));
+
+		b = time_set(-1, sz, r);
+		z_simd = 0;
+		w = time_set(0, sz, r);
+		z_simd = have_simd;
+		v = time_set(0, sz, r);
+		z_fdprintf(1, "zutils op=memset size=%lu byte_ns100=%lu word_ns100=%lu simd_ns100=%lu\n",
+				   (unsigned long)sz, per_op(b, r), per_op(w, r), per_op(v, r));
+	}
+
+	{
+		unsigned long r = z_udivmod(rounds, 64, NULL) + 1000, b, w, v;
+
+		b = time_strcmp(-1, r);
+		z_simd = 0;
+		w = time_strcmp(0, r);
+		z_simd = have_simd;
+		v = time_strcmp(0, r);
+		z_fdprintf(1, "zutils op=strcmp names=6 byte_ns100=%lu word_ns100=%lu simd_ns100=%lu\n",
+				   per_op(b, r * 6), per_op(w, r * 6), per_op(v, r * 6));
+
+		r = z_udivmod(rounds, 4096, NULL) + 100;
+		b = time_strstr(-1, r);
+		z_simd = 0;
+		w = time_strstr(0, r);
+		z_simd = have_simd;
+		v = time_strstr(0, r);
+		z_fdprintf(1, "zutils op=strstr maps_bytes=%lu byte_ns100=%lu word_ns100=%lu simd_ns100=%lu\n",
+				   maps_len,
+				   per_op(b, r), per_op(w, r), per_op(v, r));
+	}
+
+	z_fdprintf(1, "zutils simd=%d errors=%lu\n", have_simd, g_errors);
+	z_exit(g_errors ? 1 : 0);
+}
@@ -1,8 +1,26 @@
 #ifndef ELF_LOADER_H
 #define ELF_LOADER_H
 
+#include "z_elf.h"
+
 void init_exec_elf(char *argv[]);
 void exec_elf(const char *file, int argc, char *argv[]);
+/* Run fn instead of the built-in demo once foreign dlopen/dlsym are
+ * resolved. It is called on the bootstrap thread with an aligned stack. */
+void fdl_set_main(void (*fn)(void));
+/* Env changes the foreign side sees, from exec_elf() on; z_environ is
+ * left alone. One per line: NAME=value sets, NAME+=value appends with a
+ * ':' (LD_LIBRARY_PATH, GLIBC_TUNABLES), -NAME unsets, # comments. The
+ * file FDL_PROFILE names is applied after it. profile must outlive
+ * exec_elf(). */
+void fdl_set_profile(const char *profile);
+/* A variable of the env exec_elf() handed to the foreign side, profile
+ * applied; z_getenv() before exec_elf(). */
+char *fdl_getenv(const char *name);
+/* Map the PT_LOADs of an opened ELF, ET_DYN ones wherever the kernel
+ * likes. Returns where the lowest one went, which is the load bias of an
+ * ET_DYN linked at 0, or (unsigned long)-1. */
+unsigned long loadelf_anon(int fd, Elf_Ehdr *ehdr, Elf_Phdr *phdr);
 
 #endif /* ELF_LOADER_H */
 
@@ -0,0 +1,112 @@
+#include "fdl_async.h"
+#include "fdl_pool.h"
+#include "fdl_prefetch.h"
+#include "fdl_resolve.h"
+#include "z_once.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+#include <limits.h>
+
+enum
+{
+    F_FREE,
+    F_PENDING,
+    F_DONE,
+};
+
+struct fdl_future
+{
+    uint32_t state;
+    uint32_t waiters;
+    int flags;
+    void *handle;
+    char path[FDL_ASYNC_PATH_MAX];
+};
+
+typedef int (*pthread_create_t)(unsigned long *, const void *,
+                                void *(*)(void *), void *);
+typedef int (*pthread_detach_t)(unsigned long);
+
+static struct fdl_future g_futures[FDL_ASYNC_MAX];
+static z_once_t g_once = Z_ONCE_INIT;
+static pthread_create_t g_create;
+static pthread_detach_t g_detach;
+
+static void lookup_pthread(void *arg)
+{
+    (void)arg;
+    g_detach = (pthread_detach_t)fdl_pthread_sym("pthread_detach");
+    g_create = (pthread_create_t)fdl_pthread_sym("pthread_create");
+}
+
+static void *open_main(void *arg)
+{
+    void *(*my_dlopen)(const char *, int) = (void *(*)(const char *, int))fdl_dlopen_sym(NULL);
+    fdl_future_t *f = arg;
+
+    if (f->flags & FDL_ASYNC_PREFETCH)
+        fdl_prefetch(f->path, NULL);
+    f->handle = my_dlopen(f->path, f->flags & ~FDL_ASYNC_PREFETCH);
+    __atomic_store_n(&f->state, F_DONE, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&f->waiters, __ATOMIC_SEQ_CST))
+        z_futex_wake(&f->state, INT_MAX);
+    return NULL;
+}
+
+fdl_future_t *fdl_dlopen_async(const char *path, int flags)
+{
+    unsigned long thread;
+    fdl_future_t *f = NULL;
+    size_t i;
+
+    z_once(&g_once, lookup_pthread, NULL);
+    if (!g_create || !g_detach)
+        return NULL;
+
+    for (i = 0; i < FDL_ASYNC_MAX; i++)
+    {
+        uint32_t expect = F_FREE;
+        if (__atomic_compare_exchange_n(&g_futures[i].state, &expect, F_PENDING, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            f = &g_futures[i];
+            break;
+        }
+    }
+    if (!f)
+        return NULL;
+
+    for (i = 0; path[i] && i < FDL_ASYNC_PATH_MAX - 1; i++)
+        f->path[i] = path[i];
+    f->path[i] = 0;
+    f->flags = flags;
+    f->handle = NULL;
+    if (path[i] || g_create(&thread, NULL, open_main, f) != 0)
+    {
+        __atomic_store_n(&f->state, F_FREE, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    g_detach(thread);
+    return f;
+}
+
+int fdl_poll(fdl_future_t *f)
+{
+    return __atomic_load_n(&f->state, __ATOMIC_ACQUIRE) == F_DONE;
+}
+
+void *fdl_wait(fdl_future_t *f)
+{
+    void *h;
+
+    while (__atomic_load_n(&f->state, __ATOMIC_ACQUIRE) != F_DONE)
+    {
+        __atomic_fetch_add(&f->waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&f->state, __ATOMIC_SEQ_CST) == F_PENDING)
+            z_futex_wait(&f->state, F_PENDING);
+        __atomic_fetch_sub(&f->waiters, 1, __ATOMIC_RELAXED);
+    }
+    h = f->handle;
+    __atomic_store_n(&f->state, F_FREE, __ATOMIC_RELEASE);
+    return h;
+}
@@ -0,0 +1,28 @@
+#ifndef FDL_ASYNC_H
+#define FDL_ASYNC_H
+
+/*
+ * Asynchronous dlopen. Every open runs on its own detached helper thread
+ * created through the foreign pthread_create, the static side polls or
+ * waits on the returned handle. Note that glibc serializes the loads
+ * themselves on its dl_load_lock, what overlaps is our own work (and the
+ * other helpers' work outside of dlopen) with the loader's.
+ */
+
+#define FDL_ASYNC_MAX 64
+/* Or into the dlopen flags: walk and read ahead the DT_NEEDED closure on
+ * the helper thread first, see fdl_prefetch.h. Helpers do that part
+ * concurrently, ld.so then loads from a warm page cache. */
+#define FDL_ASYNC_PREFETCH 0x40000000
+#define FDL_ASYNC_PATH_MAX 512
+
+typedef struct fdl_future fdl_future_t;
+
+/* NULL when no slot or helper thread is available. */
+fdl_future_t *fdl_dlopen_async(const char *path, int flags);
+/* 1 once the open has completed, 0 while it is in flight. */
+int fdl_poll(fdl_future_t *f);
+/* Block until completion, return the dlopen handle and release f. */
+void *fdl_wait(fdl_future_t *f);
+
+#endif /* FDL_ASYNC_H */
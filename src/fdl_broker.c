@@ -0,0 +1,413 @@
+#include "fdl_broker.h"
+#include "fdl_resolve.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+#include <limits.h>
+#include <linux/errno.h>
+
+/* Spin this many times before going to sleep on the slot futex. */
+#define SLOT_SPIN 128
+/* The broker checks on the client after waiting this long for a slot. */
+#define SLOT_CHECK_NS 100000000L
+
+#define OWNER(t, pid) ((uint64_t)(t) << 32 | (uint32_t)(pid))
+#define OWNER_TICKET(o) ((uint32_t)((o) >> 32))
+#define OWNER_PID(o) ((uint32_t)(o))
+
+typedef long (*fdl_call6_t)(unsigned long, unsigned long, unsigned long,
+                            unsigned long, unsigned long, unsigned long);
+
+static fdl_slot_t *slot_of(fdl_ring_t *r, uint32_t t)
+{
+    return &r->slots[t & (FDL_BROKER_NSLOTS - 1)];
+}
+
+/* Sleep while the slot still reads seq, -1 once rel (if any) ran out. */
+static int slot_sleep(fdl_slot_t *s, uint32_t seq, const struct timespec *rel)
+{
+    int rc = 0;
+
+    /* Announce ourselves before the final check, slot_post() pairs
+     * its seq store with the waiters load in the same order. */
+    __atomic_fetch_add(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->seq, __ATOMIC_SEQ_CST) == seq &&
+        z_futex_timedwait(&s->seq, seq, rel) < 0 && z_errno == ETIMEDOUT)
+        rc = -1;
+    __atomic_fetch_sub(&s->waiters, 1, __ATOMIC_RELAXED);
+    return rc;
+}
+
+static void slot_wait(fdl_slot_t *s, uint32_t want)
+{
+    uint32_t seq;
+    int spin = 0;
+
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) != want)
+    {
+        if (spin++ < SLOT_SPIN)
+            z_cpu_relax();
+        else
+            slot_sleep(s, seq, NULL);
+    }
+}
+
+static void slot_post(fdl_slot_t *s, uint32_t seq)
+{
+    __atomic_store_n(&s->seq, seq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST))
+        z_futex_wake(&s->seq, INT_MAX);
+}
+
+static void ring_init(fdl_ring_t *r)
+{
+    z_memset(r, 0, sizeof(*r));
+    for (uint32_t i = 0; i < FDL_BROKER_NSLOTS; i++)
+    {
+        r->slots[i].seq = i;
+        /* Claimed on the lap before the first one, by nobody. */
+        r->slots[i].owner = OWNER(i - FDL_BROKER_NSLOTS, 0);
+    }
+    __atomic_store_n(&r->magic, FDL_BROKER_MAGIC, __ATOMIC_RELEASE);
+}
+
+fdl_ring_t *fdl_broker_create(int *fd)
+{
+    fdl_ring_t *r;
+
+    *fd = z_memfd_create("fdl-broker", 0);
+    if (*fd < 0)
+        return NULL;
+    if (z_ftruncate(*fd, sizeof(*r)) < 0)
+        goto err;
+    r = z_mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (r == (void *)-1)
+        goto err;
+    ring_init(r);
+    return r;
+err:
+    z_close(*fd);
+    *fd = -1;
+    return NULL;
+}
+
+fdl_ring_t *fdl_broker_attach(int fd)
+{
+    fdl_ring_t *r;
+
+    r = z_mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (r == (void *)-1)
+        return NULL;
+    if (__atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) != FDL_BROKER_MAGIC)
+    {
+        z_munmap(r, sizeof(*r));
+        return NULL;
+    }
+    return r;
+}
+
+/* Broker side */
+
+typedef struct
+{
+    char name[FDL_BROKER_BLOBSZ];
+    void *h;
+} broker_lib_t;
+
+typedef struct
+{
+    void *self;
+    void *syms[FDL_BROKER_MAXSYMS];
+    uint32_t nsyms;
+    /* Each library is opened once, resolves must not pile up references
+     * the broker never drops. */
+    broker_lib_t libs[FDL_BROKER_MAXLIBS];
+    uint32_t nlibs;
+} broker_t;
+
+/* kill(pid, 0) still finds a zombie nobody waited for, so look at its
+ * state in /proc as well. */
+static int owner_dead(uint64_t owner)
+{
+    char path[32], buf[64], *p;
+    unsigned long pid = OWNER_PID(owner), rem;
+    ssize_t n;
+    int fd;
+
+    if (z_kill(pid, 0) < 0)
+        return z_errno == ESRCH;
+
+    p = path + sizeof(path);
+    *--p = 0;
+    p -= 5;
+    z_memcpy(p, "/stat", 5);
+    do
+    {
+        pid = z_udivmod(pid, 10, &rem);
+        *--p = '0' + rem;
+    } while (pid);
+    p -= 6;
+    z_memcpy(p, "/proc/", 6);
+
+    if ((fd = z_open(p, O_RDONLY)) < 0)
+        return 1;
+    n = z_read(fd, buf, sizeof(buf));
+    z_close(fd);
+    /* "pid (comm) S ...", comm is at most 16 bytes and may hold ") ". */
+    for (p = buf + (n > 0 ? n : 0); p > buf && *--p != ')';)
+        ;
+    return *p == ')' && p + 2 < buf + n && (p[2] == 'Z' || p[2] == 'X');
+}
+
+/*
+ * Wait for request t like slot_wait(), but every SLOT_CHECK_NS look at the
+ * client holding the slot up. If it died, consume its last result or skip
+ * its ticket in its place. Returns -1 when ticket t was skipped.
+ */
+static int broker_wait(fdl_ring_t *r, fdl_slot_t *s, uint32_t t)
+{
+    const struct timespec rel = { 0, SLOT_CHECK_NS };
+    uint64_t owner;
+    uint32_t seq;
+    int spin = 0;
+
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) != t + 1)
+    {
+        if (spin++ < SLOT_SPIN)
+        {
+            z_cpu_relax();
+            continue;
+        }
+        if (slot_sleep(s, seq, &rel) == 0)
+            continue;
+
+        owner = __atomic_load_n(&s->owner, __ATOMIC_ACQUIRE);
+        if (seq == t - FDL_BROKER_NSLOTS + 2 &&
+            OWNER_TICKET(owner) == t - FDL_BROKER_NSLOTS && owner_dead(owner))
+        {
+            /* The last lap's client never took its result. */
+            if (__atomic_compare_exchange_n(&s->seq, &seq, t, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                z_futex_wake(&s->seq, INT_MAX);
+        }
+        else if (seq == t && OWNER_TICKET(owner) == t && owner_dead(owner))
+        {
+            /* Claimed and never posted, maybe before head moved on. */
+            __atomic_compare_exchange_n(&r->head, &seq, t + 1, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+            slot_post(s, t + FDL_BROKER_NSLOTS);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *broker_open(broker_t *b, const char *lib)
+{
+    void *(*my_dlopen)(const char *, int) = (void *(*)(const char *, int))fdl_dlopen_sym(NULL);
+    broker_lib_t *l;
+    uint32_t i;
+
+    if (!*lib)
+        return b->self;
+    for (i = 0; i < b->nlibs; i++)
+        if (z_strcmp(b->libs[i].name, lib) == 0)
+            return b->libs[i].h;
+    if (b->nlibs == FDL_BROKER_MAXLIBS)
+        return NULL;
+    l = &b->libs[b->nlibs];
+    if ((l->h = my_dlopen(lib, RTLD_NOW)) == NULL)
+        return NULL;
+    for (i = 0; (l->name[i] = lib[i]); i++)
+        ;
+    b->nlibs++;
+    return l->h;
+}
+
+static long broker_resolve(broker_t *b, fdl_slot_t *s)
+{
+    void *(*my_dlsym)(void *, const char *) = (void *(*)(void *, const char *))fdl_dlsym_sym(NULL);
+    const char *lib = s->blob, *name;
+    void *h, *p;
+    uint32_t i;
+
+    s->blob[FDL_BROKER_BLOBSZ - 1] = 0;
+    for (name = lib; *name; name++)
+        ;
+    if (++name >= s->blob + FDL_BROKER_BLOBSZ)
+        return -1;
+
+    h = broker_open(b, lib);
+    if (!h)
+        return -1;
+    p = my_dlsym(h, name);
+    if (!p)
+        return -1;
+    for (i = 0; i < b->nsyms; i++)
+        if (b->syms[i] == p)
+            return i;
+    if (b->nsyms == FDL_BROKER_MAXSYMS)
+        return -1;
+    b->syms[b->nsyms] = p;
+    return b->nsyms++;
+}
+
+static long broker_call(broker_t *b, fdl_slot_t *s)
+{
+    unsigned long a[FDL_BROKER_MAXARGS];
+    fdl_call6_t fn;
+
+    if (s->sym >= b->nsyms)
+        return -1;
+    fn = (fdl_call6_t)b->syms[s->sym];
+    for (int i = 0; i < FDL_BROKER_MAXARGS; i++)
+    {
+        a[i] = s->args[i];
+        if (s->blobargs & (1U << i))
+            a[i] += (unsigned long)s->blob;
+    }
+    return fn(a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+void fdl_broker_serve(fdl_ring_t *r)
+{
+    void *(*my_dlopen)(const char *, int) = (void *(*)(const char *, int))fdl_dlopen_sym(NULL);
+    broker_t b;
+    uint32_t op;
+
+    b.self = my_dlopen(NULL, RTLD_NOW);
+    b.nsyms = 0;
+    b.nlibs = 0;
+
+    __atomic_store_n(&r->ready, 1, __ATOMIC_RELEASE);
+    z_futex_wake(&r->ready, INT_MAX);
+
+    for (uint32_t t = 0;; t++)
+    {
+        fdl_slot_t *s = slot_of(r, t);
+
+        if (broker_wait(r, s, t) < 0)
+            continue;
+        switch ((op = s->op))
+        {
+        case FDL_OP_RESOLVE:
+            s->ret = broker_resolve(&b, s);
+            break;
+        case FDL_OP_CALL:
+            s->ret = broker_call(&b, s);
+            break;
+        case FDL_OP_STOP:
+            s->ret = 0;
+            break;
+        default:
+            s->ret = -1;
+            break;
+        }
+        slot_post(s, t + 2);
+        if (op == FDL_OP_STOP)
+            return;
+    }
+}
+
+/* Client side */
+
+/* Take ticket head once its slot is free: claim the slot under our pid,
+ * then move head on, so the broker can tell who holds any ticket. */
+static fdl_slot_t *client_begin(fdl_ring_t *r, uint32_t *t)
+{
+    uint32_t me = (uint32_t)z_getpid(), seq;
+    uint64_t owner;
+    fdl_slot_t *s;
+    int spin = 0;
+
+    for (;;)
+    {
+        *t = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        s = slot_of(r, *t);
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq == *t)
+        {
+            owner = __atomic_load_n(&s->owner, __ATOMIC_RELAXED);
+            if (OWNER_TICKET(owner) != *t &&
+                __atomic_compare_exchange_n(&s->owner, &owner, OWNER(*t, me), 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            {
+                __atomic_store_n(&r->head, *t + 1, __ATOMIC_RELEASE);
+                return s;
+            }
+        }
+        else if ((int32_t)(seq - *t) > 0)
+        {
+            /* Someone took ticket t since we read head. */
+            continue;
+        }
+        /* The last lap still holds the slot, or another client is halfway
+         * through claiming it. */
+        if (spin++ < SLOT_SPIN)
+            z_cpu_relax();
+        else
+            slot_sleep(s, seq, NULL);
+    }
+}
+
+static long client_finish(fdl_slot_t *s, uint32_t t, void *blob, size_t bloblen)
+{
+    long ret;
+
+    slot_post(s, t + 1);
+    slot_wait(s, t + 2);
+    ret = s->ret;
+    if (blob)
+        z_memcpy(blob, s->blob, bloblen);
+    slot_post(s, t + FDL_BROKER_NSLOTS);
+    return ret;
+}
+
+long fdl_broker_resolve(fdl_ring_t *r, const char *lib, const char *sym)
+{
+    fdl_slot_t *s;
+    uint32_t t;
+    char *p;
+
+    s = client_begin(r, &t);
+    s->op = FDL_OP_RESOLVE;
+    p = s->blob;
+    /* Leave room for both terminators, the broker rejects a cut-off name. */
+    while (lib && *lib && p < s->blob + FDL_BROKER_BLOBSZ - 2)
+        *p++ = *lib++;
+    *p++ = 0;
+    while (*sym && p < s->blob + FDL_BROKER_BLOBSZ - 1)
+        *p++ = *sym++;
+    *p = 0;
+    return client_finish(s, t, NULL, 0);
+}
+
+long fdl_broker_call(fdl_ring_t *r, uint32_t sym, int nargs,
+                     const unsigned long *args, uint32_t blobargs,
+                     void *blob, size_t bloblen)
+{
+    fdl_slot_t *s;
+    uint32_t t;
+
+    if (nargs > FDL_BROKER_MAXARGS || bloblen > FDL_BROKER_BLOBSZ)
+        return -1;
+
+    s = client_begin(r, &t);
+    s->op = FDL_OP_CALL;
+    s->sym = sym;
+    s->blobargs = blobargs;
+    for (int i = 0; i < FDL_BROKER_MAXARGS; i++)
+        s->args[i] = i < nargs ? args[i] : 0;
+    if (bloblen)
+        z_memcpy(s->blob, blob, bloblen);
+    return client_finish(s, t, bloblen ? blob : NULL, bloblen);
+}
+
+void fdl_broker_stop(fdl_ring_t *r)
+{
+    fdl_slot_t *s;
+    uint32_t t;
+
+    s = client_begin(r, &t);
+    s->op = FDL_OP_STOP;
+    client_finish(s, t, NULL, 0);
+}
@@ -0,0 +1,78 @@
+#ifndef FDL_BROKER_H
+#define FDL_BROKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Broker mode: one process bootstraps the foreign runtime and serves calls
+ * for any number of static clients through a ring in a shared memfd.
+ *
+ * Clients take a ticket from ring->head once the slot it maps to is free,
+ * fill the slot and the broker (the single consumer) runs the requests in
+ * ticket order. Each slot carries its own sequence word, which doubles as
+ * the futex both sides sleep on:
+ *
+ *   seq == t            slot is free for ticket t
+ *   seq == t + 1        request t is ready for the broker
+ *   seq == t + 2        request t is done, result is in the slot
+ *   seq == t + NSLOTS   client consumed the result, free for the next lap
+ *
+ * A client claims ticket t by writing t and its pid to the slot owner
+ * before it moves head on. When the broker waits too long for a slot it
+ * checks that pid, and if the client died it takes the ticket or consumes
+ * the result in its place, so a killed client can't stall the ring.
+ */
+
+#define FDL_BROKER_MAGIC 0x46444c42 /* "FDLB" */
+#define FDL_BROKER_NSLOTS 64        /* must be a power of two */
+#define FDL_BROKER_MAXARGS 6
+#define FDL_BROKER_BLOBSZ 232       /* a slot is five cache lines */
+#define FDL_BROKER_MAXSYMS 128
+#define FDL_BROKER_MAXLIBS 16
+
+enum
+{
+    FDL_OP_RESOLVE = 1, /* blob: "lib\0sym\0", empty lib is the default handle */
+    FDL_OP_CALL,        /* call sym with args, returns its long result */
+    FDL_OP_STOP,        /* broker leaves fdl_broker_serve() */
+};
+
+typedef struct
+{
+    uint32_t seq;
+    uint32_t waiters;
+    uint32_t op;
+    uint32_t sym;
+    /* Bit i set: args[i] is an offset into blob, the broker rebases it. */
+    uint32_t blobargs;
+    /* Ticket << 32 | pid of the client that claimed the slot last. */
+    uint64_t owner;
+    unsigned long args[FDL_BROKER_MAXARGS];
+    long ret;
+    char blob[FDL_BROKER_BLOBSZ];
+} __attribute__((aligned(64))) fdl_slot_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t ready;
+    uint32_t head __attribute__((aligned(64)));
+    fdl_slot_t slots[FDL_BROKER_NSLOTS];
+} fdl_ring_t;
+
+/* Create the shared ring; *fd receives the memfd to hand to clients. */
+fdl_ring_t *fdl_broker_create(int *fd);
+/* Map a ring created by fdl_broker_create() (inherited fd or /proc path). */
+fdl_ring_t *fdl_broker_attach(int fd);
+/* Broker side: serve requests until FDL_OP_STOP. Needs the foreign runtime. */
+void fdl_broker_serve(fdl_ring_t *r);
+
+/* Client side, -1 means the broker could not resolve or run the request. */
+long fdl_broker_resolve(fdl_ring_t *r, const char *lib, const char *sym);
+long fdl_broker_call(fdl_ring_t *r, uint32_t sym, int nargs,
+                     const unsigned long *args, uint32_t blobargs,
+                     void *blob, size_t bloblen);
+void fdl_broker_stop(fdl_ring_t *r);
+
+#endif /* FDL_BROKER_H */
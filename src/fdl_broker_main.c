@@ -0,0 +1,37 @@
+#include "z_utils.h"
+#include "z_syscalls.h"
+#include "elf_loader.h"
+#include "fdl_broker.h"
+
+#define DL_APP_DEFAULT "/bin/sleep"
+
+static fdl_ring_t *g_ring;
+
+static void broker_main(void)
+{
+	fdl_broker_serve(g_ring);
+}
+
+/* Usage: fdl_broker [host program]
+ * Prints the path clients open (O_RDWR) and pass to fdl_broker_attach(). */
+int main(int argc, char *argv[])
+{
+	const char *app;
+	int fd;
+
+	if (argc > 1 && argv[1] && argv[1][0]) {
+		app = argv[1];
+	} else {
+		app = DL_APP_DEFAULT;
+	}
+
+	if ((g_ring = fdl_broker_create(&fd)) == NULL)
+		z_errx(1, "can't create broker ring");
+	z_fdprintf(1, "/proc/%d/fd/%d\n", z_getpid(), fd);
+
+	fdl_set_main(broker_main);
+	char *targv[] = { (char *)app, (char *)"x" };
+	exec_elf(app, 2, targv);
+
+	z_exit(0);
+}
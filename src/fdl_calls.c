@@ -0,0 +1,423 @@
+#include "fdl_calls.h"
+#include "fdl_resolve.h"
+#include "z_asm.h"
+#include "z_elf.h"
+#include "z_log.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define CALLS_STUBS 1
+#endif
+#define STUB_SIZE 16 /* .balign in <arch>/z_calls.S */
+
+typedef struct
+{
+    void *ret;
+    unsigned long sp; /* the caller's, once the call returns */
+    uint64_t t0;
+    uint32_t sym;
+} frame_t;
+
+/* Written by its own thread only, the dump reads it as it goes. */
+typedef struct
+{
+    unsigned long tp;
+    uint32_t depth;
+    frame_t stack[FDL_CALLS_DEPTH];
+    uint64_t calls[FDL_CALLS_SYMS];
+    uint64_t ticks[FDL_CALLS_SYMS];
+    uint32_t hist[FDL_CALLS_SYMS][FDL_CALLS_BUCKETS];
+} thread_t;
+
+typedef struct
+{
+    void *target;
+    char name[40];
+} sym_t;
+
+typedef struct
+{
+    const char *dli_fname;
+    void *dli_fbase;
+    const char *dli_sname;
+    void *dli_saddr;
+} dl_info_t;
+
+/* A slot whose thread has exited, free for another one. */
+#define TP_DEAD 1UL
+
+static thread_t g_threads[FDL_CALLS_THREADS];
+/* The counts of the threads that exited, under g_lock. */
+static thread_t g_retired;
+static sym_t g_syms[FDL_CALLS_SYMS];
+static uint32_t g_nsyms;
+static uint32_t g_lock;
+/* Calls that went uncounted: no thread slot or shadow stack left. */
+static unsigned long g_lost;
+/* Counter and clock at the first wrap, to scale ticks in the dump. */
+static uint64_t g_tick0;
+static struct timespec g_ts0;
+static void *g_dlsym_stub;
+/* Foreign helpers, see setup(). 0 none yet, 1 being set up, 2 done. */
+static uint32_t g_setup;
+static int (*g_dladdr)(const void *, dl_info_t *);
+static int (*g_setspecific)(unsigned, const void *);
+static unsigned g_key;
+static int g_key_ok;
+
+PRIVATE void *fdl_calls_enter(uint32_t sym, void **ret, unsigned long sp);
+PRIVATE void *fdl_calls_exit(unsigned long sp);
+
+static inline uint64_t ticks(void)
+{
+#if defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return 0;
+#endif
+}
+
+/* The foreign libc's TCB, set on every thread ld.so or pthread_create
+ * made. */
+static inline unsigned long thread_pointer(void)
+{
+    unsigned long tp = 0;
+#if defined(__x86_64__)
+    __asm__("mov %%fs:0, %0" : "=r"(tp));
+#elif defined(__aarch64__)
+    __asm__("mrs %0, tpidr_el0" : "=r"(tp));
+#endif
+    return tp;
+}
+
+static void lock(void)
+{
+    while (__atomic_exchange_n(&g_lock, 1, __ATOMIC_ACQUIRE))
+        z_cpu_relax();
+}
+
+static void unlock(void)
+{
+    __atomic_store_n(&g_lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Run by the foreign libc when a thread that has a slot exits: its
+ * counts go to g_retired and the slot to the next thread. */
+static void thread_exit(void *arg)
+{
+    thread_t *t = arg;
+
+    lock();
+    for (int s = 0; s < FDL_CALLS_SYMS; s++)
+    {
+        g_retired.calls[s] += t->calls[s];
+        g_retired.ticks[s] += t->ticks[s];
+        for (int b = 0; b < FDL_CALLS_BUCKETS; b++)
+            g_retired.hist[s][b] += t->hist[s][b];
+    }
+    z_memset(t->calls, 0, sizeof(t->calls));
+    z_memset(t->ticks, 0, sizeof(t->ticks));
+    z_memset(t->hist, 0, sizeof(t->hist));
+    t->depth = 0;
+    __atomic_store_n(&t->tp, TP_DEAD, __ATOMIC_RELEASE);
+    unlock();
+}
+
+static thread_t *self(void)
+{
+    unsigned long tp = thread_pointer();
+    uint32_t h = (uint32_t)((tp >> 4) * 0x9e3779b1u);
+
+    for (;;)
+    {
+        thread_t *free = NULL;
+        unsigned long cur = 0;
+
+        /* Ours is before the first never used slot, if we have one. */
+        for (uint32_t i = 0; i < FDL_CALLS_THREADS; i++)
+        {
+            thread_t *t = &g_threads[(h + i) & (FDL_CALLS_THREADS - 1)];
+
+            cur = __atomic_load_n(&t->tp, __ATOMIC_ACQUIRE);
+            if (cur == tp)
+                return t;
+            if (cur == TP_DEAD && !free)
+                free = t;
+            if (cur == 0)
+            {
+                if (!free)
+                    free = t;
+                break;
+            }
+        }
+        if (!free)
+            return NULL;
+        cur = __atomic_load_n(&free->tp, __ATOMIC_ACQUIRE);
+        if ((cur == 0 || cur == TP_DEAD) &&
+            __atomic_compare_exchange_n(&free->tp, &cur, tp, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+        {
+            if (__atomic_load_n(&g_key_ok, __ATOMIC_ACQUIRE))
+                g_setspecific(g_key, free);
+            return free;
+        }
+    }
+}
+
+#ifdef CALLS_STUBS
+void *fdl_calls_enter(uint32_t sym, void **ret, unsigned long sp)
+{
+    void *target = __atomic_load_n(&g_syms[sym].target, __ATOMIC_ACQUIRE);
+    thread_t *t = self();
+    frame_t *f;
+
+    if (!t)
+    {
+        __atomic_add_fetch(&g_lost, 1, __ATOMIC_RELAXED);
+        return target;
+    }
+    /* Calls a longjmp left can't be below us. */
+    while (t->depth && t->stack[t->depth - 1].sp <= sp)
+        t->depth--;
+    if (t->depth == FDL_CALLS_DEPTH)
+    {
+        __atomic_add_fetch(&g_lost, 1, __ATOMIC_RELAXED);
+        return target;
+    }
+    f = &t->stack[t->depth++];
+    f->ret = *ret;
+    f->sp = sp;
+    f->sym = sym;
+    *ret = (void *)z_calls_exit;
+    f->t0 = ticks();
+    return target;
+}
+
+void *fdl_calls_exit(unsigned long sp)
+{
+    uint64_t dt = ticks();
+    thread_t *t = self();
+    frame_t *f;
+    int b;
+
+    /* Inner calls a longjmp skipped. */
+    while (t->depth > 1 && t->stack[t->depth - 1].sp < sp)
+        t->depth--;
+    f = &t->stack[--t->depth];
+    dt -= f->t0;
+    b = 63 - __builtin_clzll(dt | 1);
+    if (b >= FDL_CALLS_BUCKETS)
+        b = FDL_CALLS_BUCKETS - 1;
+    t->calls[f->sym]++;
+    t->ticks[f->sym] += dt;
+    t->hist[f->sym][b]++;
+    return f->ret;
+}
+#endif
+
+/* dladdr() for is_code(), and a pthread key whose destructor frees the
+ * slot of an exiting thread. Whoever comes first sets them up, the others
+ * go on without: no foreign call is made with g_lock held or waited for,
+ * it could need ld.so's lock, held by a thread coming back to us. */
+static void setup(void)
+{
+    void *(*my_dlopen)(const char *, int) = __atomic_load_n(&fdl_dlopen, __ATOMIC_ACQUIRE);
+    void *(*my_dlsym)(void *, const char *) = __atomic_load_n(&fdl_dlsym, __ATOMIC_ACQUIRE);
+    int (*key_create)(unsigned *, void (*)(void *));
+    uint32_t expect = 0;
+    void *h;
+
+    if (!my_dlopen || !my_dlsym ||
+        !__atomic_compare_exchange_n(&g_setup, &expect, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+    if ((h = my_dlopen(NULL, RTLD_NOW)) != NULL)
+    {
+        key_create = (int (*)(unsigned *, void (*)(void *)))my_dlsym(h, "pthread_key_create");
+        g_setspecific = (int (*)(unsigned, const void *))my_dlsym(h, "pthread_setspecific");
+        if (key_create && g_setspecific && key_create(&g_key, thread_exit) == 0)
+            __atomic_store_n(&g_key_ok, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&g_dladdr, (int (*)(const void *, dl_info_t *))my_dlsym(h, "dladdr"),
+                         __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&g_setup, 2, __ATOMIC_RELEASE);
+}
+
+/* Only code gets a stub, dlsym() returns data as well. */
+static int is_code(void *fn)
+{
+    int (*my_dladdr)(const void *, dl_info_t *) = __atomic_load_n(&g_dladdr, __ATOMIC_ACQUIRE);
+    unsigned long addr = (unsigned long)fn, bias;
+    dl_info_t info;
+    Elf_Ehdr *eh;
+    Elf_Phdr *ph;
+
+    if (!my_dladdr || !my_dladdr(fn, &info) || !info.dli_fbase)
+        return 0;
+    eh = info.dli_fbase;
+    bias = eh->e_type == ET_DYN ? (unsigned long)eh : 0;
+    ph = (Elf_Phdr *)((char *)eh + eh->e_phoff);
+    for (int i = 0; i < eh->e_phnum; i++)
+    {
+        if (ph[i].p_type == PT_LOAD && (ph[i].p_flags & PF_X) &&
+            addr >= bias + ph[i].p_vaddr && addr < bias + ph[i].p_vaddr + ph[i].p_memsz)
+            return 1;
+    }
+    return 0;
+}
+
+/* Index of fn's stub, n if it has none yet. */
+static uint32_t find(void *fn, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n && __atomic_load_n(&g_syms[i].target, __ATOMIC_ACQUIRE) != fn; i++)
+        ;
+    return i;
+}
+
+void *fdl_calls_wrap(const char *name, void *fn)
+{
+#ifdef CALLS_STUBS
+    char *stubs = (char *)z_calls_stubs;
+    uint32_t i, n;
+    void *stub = fn;
+
+    if (!fn || ((char *)fn >= stubs && (char *)fn < stubs + FDL_CALLS_SYMS * STUB_SIZE))
+        return fn;
+    n = __atomic_load_n(&g_nsyms, __ATOMIC_ACQUIRE);
+    if ((i = find(fn, n)) < n)
+        return stubs + i * STUB_SIZE;
+    if (__atomic_load_n(&g_setup, __ATOMIC_ACQUIRE) == 0)
+        setup();
+    if (!is_code(fn))
+        return fn;
+
+    lock();
+    if (!g_tick0)
+    {
+        z_clock_gettime(CLOCK_MONOTONIC, &g_ts0);
+        g_tick0 = ticks();
+    }
+    /* Another thread may have added it meanwhile. */
+    n = g_nsyms;
+    if ((i = find(fn, n)) == n && n < FDL_CALLS_SYMS)
+    {
+        size_t k;
+
+        for (k = 0; name[k] && k < sizeof(g_syms[i].name) - 1; k++)
+            g_syms[i].name[k] = name[k];
+        g_syms[i].name[k] = 0;
+        __atomic_store_n(&g_syms[i].target, fn, __ATOMIC_RELEASE);
+        __atomic_store_n(&g_nsyms, n + 1, __ATOMIC_RELEASE);
+        n++;
+    }
+    if (i < n)
+        stub = stubs + i * STUB_SIZE;
+    unlock();
+    return stub;
+#else
+    (void)name;
+    return fn;
+#endif
+}
+
+void *fdl_calls_dlsym(void *h, const char *name)
+{
+    void *(*my_dlsym)(void *, const char *) = __atomic_load_n(&g_dlsym_stub, __ATOMIC_ACQUIRE);
+
+    if (!my_dlsym)
+    {
+        my_dlsym = fdl_calls_wrap("dlsym", __atomic_load_n(&fdl_dlsym, __ATOMIC_ACQUIRE));
+        __atomic_store_n(&g_dlsym_stub, (void *)my_dlsym, __ATOMIC_RELEASE);
+    }
+    return fdl_calls_wrap(name, my_dlsym(h, name));
+}
+
+void fdl_calls_dump(int fd)
+{
+    static uint32_t dumped;
+    uint32_t n = __atomic_load_n(&g_nsyms, __ATOMIC_ACQUIRE);
+    unsigned long scale, lost = __atomic_load_n(&g_lost, __ATOMIC_RELAXED);
+    uint64_t el_ticks = ticks() - g_tick0, el_ns;
+    struct timespec ts;
+    /* sym= and the numbers fit, whatever the histogram looks like */
+    char line[128 + FDL_CALLS_BUCKETS * 48], *p;
+
+    if (!g_tick0 || __atomic_exchange_n(&dumped, 1, __ATOMIC_RELAXED))
+        return;
+    z_clock_gettime(CLOCK_MONOTONIC, &ts);
+    el_ns = (uint64_t)(ts.tv_sec - g_ts0.tv_sec) * 1000000000ULL + ts.tv_nsec - g_ts0.tv_nsec;
+    /* ns per tick, times 1024 */
+    scale = z_udivmod(el_ns << 10, el_ticks + 1, NULL);
+
+    for (uint32_t s = 0; s < n; s++)
+    {
+        uint64_t calls = 0, sum = 0, seen = 0, p50 = 0, p99 = 0;
+        uint64_t hist[FDL_CALLS_BUCKETS] = { 0 };
+        int first = 1;
+
+        /* Exiting threads move their counts under the lock. */
+        lock();
+        for (int t = 0; t <= FDL_CALLS_THREADS; t++)
+        {
+            const thread_t *th = t < FDL_CALLS_THREADS ? &g_threads[t] : &g_retired;
+
+            calls += th->calls[s];
+            sum += th->ticks[s];
+            for (int b = 0; b < FDL_CALLS_BUCKETS; b++)
+                hist[b] += th->hist[s][b];
+        }
+        unlock();
+        if (!calls)
+            continue;
+        for (int b = 0; b < FDL_CALLS_BUCKETS; b++)
+        {
+            /* upper bound of bucket b */
+            uint64_t ns = ((2ULL << b) * scale) >> 10;
+
+            seen += hist[b];
+            if (!p50 && seen * 2 >= calls)
+                p50 = ns;
+            if (!p99 && seen * 100 >= calls * 99)
+                p99 = ns;
+        }
+        p = z_fmt_str(line, "calls sym=");
+        p = z_fmt_str(p, g_syms[s].name);
+        p = z_fmt_str(p, " calls=");
+        p = z_fmt_ulong(p, calls);
+        p = z_fmt_str(p, " ns=");
+        p = z_fmt_ulong(p, (sum * scale) >> 10);
+        p = z_fmt_str(p, " p50_ns=");
+        p = z_fmt_ulong(p, p50);
+        p = z_fmt_str(p, " p99_ns=");
+        p = z_fmt_ulong(p, p99);
+        p = z_fmt_str(p, " hist=");
+        for (int b = 0; b < FDL_CALLS_BUCKETS; b++)
+        {
+            if (!hist[b])
+                continue;
+            if (!first)
+                *p++ = ',';
+            p = z_fmt_ulong(p, ((2ULL << b) * scale) >> 10);
+            *p++ = ':';
+            p = z_fmt_ulong(p, hist[b]);
+            first = 0;
+        }
+        *p++ = '\n';
+        z_write(fd, line, p - line);
+    }
+    if (lost)
+    {
+        p = z_fmt_str(line, "calls lost=");
+        p = z_fmt_ulong(p, lost);
+        *p++ = '\n';
+        z_write(fd, line, p - line);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef FDL_CALLS_H
+#define FDL_CALLS_H
+
+/*
+ * Per-symbol call counts and latency histograms for foreign calls, built
+ * in with CALLS=1 only (amd64 and aarch64). The foreign pointers the
+ * resolver hands out (fdl_dlopen_sym(), fdl_dlsym_sym(), fdl_default_sym()
+ * and the functions the handed out dlsym returns) are replaced by entry
+ * stubs. A stub keeps the real return address on a per-thread shadow
+ * stack and returns through a common exit that times the call. Counts go
+ * to a fixed table per foreign thread, keyed by its thread pointer and
+ * written by that thread only. A pthread key destructor moves the counts
+ * of an exiting thread aside and frees its slot for the next one.
+ *
+ * fdl_calls_dump() prints, per symbol, the calls, total time and a
+ * histogram in power of two buckets:
+ *
+ *   calls sym=printf calls=12 ns=38211 p50_ns=2048 p99_ns=8192 hist=1024:3,2048:8,8192:1
+ *
+ * It runs from the loader's fini and when the built-in foreign main
+ * returns; call it yourself before z_exit().
+ */
+
+#define FDL_CALLS_SYMS 64 /* stubs in <arch>/z_calls.S */
+#define FDL_CALLS_THREADS 64
+#define FDL_CALLS_DEPTH 32
+#define FDL_CALLS_BUCKETS 40
+
+#ifdef Z_CALLS
+/* A stub calling fn, the same one for the same fn. fn itself when it
+ * can't be counted (no stub left, unsupported arch, NULL). */
+void *fdl_calls_wrap(const char *name, void *fn);
+/* What fdl_dlsym_sym() hands out: a counted dlsym() whose results are
+ * wrapped too. */
+void *fdl_calls_dlsym(void *h, const char *name);
+void fdl_calls_dump(int fd);
+#else
+#define fdl_calls_wrap(name, fn) (fn)
+#define fdl_calls_dump(fd) \
+    do                     \
+    {                      \
+    } while (0)
+#endif
+
+#endif /* FDL_CALLS_H */
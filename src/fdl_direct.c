@@ -0,0 +1,437 @@
+#include "fdl_direct.h"
+#include "fdl_resolve.h"
+#include "elf_loader.h"
+#include "z_elf.h"
+#include "z_log.h"
+#include "z_perfmap.h"
+#include "z_prof.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+
+#if defined(__x86_64__)
+#define R_NONE R_X86_64_NONE
+#define R_ABS R_X86_64_64
+#define R_GLOB_DAT R_X86_64_GLOB_DAT
+#define R_JUMP_SLOT R_X86_64_JUMP_SLOT
+#define R_RELATIVE R_X86_64_RELATIVE
+#elif defined(__i386__)
+#define R_NONE R_386_NONE
+#define R_ABS R_386_32
+#define R_GLOB_DAT R_386_GLOB_DAT
+#define R_JUMP_SLOT R_386_JMP_SLOT
+#define R_RELATIVE R_386_RELATIVE
+#elif defined(__aarch64__)
+#define R_NONE R_AARCH64_NONE
+#define R_ABS R_AARCH64_ABS64
+#define R_GLOB_DAT R_AARCH64_GLOB_DAT
+#define R_JUMP_SLOT R_AARCH64_JUMP_SLOT
+#define R_RELATIVE R_AARCH64_RELATIVE
+#elif defined(__arm__)
+#define R_NONE R_ARM_NONE
+#define R_ABS R_ARM_ABS32
+#define R_GLOB_DAT R_ARM_GLOB_DAT
+#define R_JUMP_SLOT R_ARM_JUMP_SLOT
+#define R_RELATIVE R_ARM_RELATIVE
+#endif
+
+#define PAGE_SIZE 4096
+#define ALIGN (PAGE_SIZE - 1)
+#define ROUND_PG(x) (((x) + (ALIGN)) & ~(ALIGN))
+#define TRUNC_PG(x) ((x) & ~(ALIGN))
+#define MAX_PHDR 64
+
+enum
+{
+    S_FREE,
+    S_USED,
+};
+
+struct fdl_direct
+{
+    uint32_t state;
+    fdl_mod_t mod;
+    unsigned long base, size;
+    const fdl_export_t *exports;
+    Elf_Addr *fini_array;
+    unsigned long fini_count;
+    Elf_Addr fini;
+};
+
+/* What the object's DT_* entries ask for, as addresses. */
+typedef struct
+{
+    unsigned long rel, relsz, rela, relasz, relr, relrsz;
+    unsigned long jmprel, pltrelsz, pltrel;
+    unsigned long init, init_array, init_arraysz;
+    unsigned long fini, fini_array, fini_arraysz;
+    int textrel;
+} dyn_info_t;
+
+typedef void (*init_fn_t)(int, char **, char **);
+
+static fdl_direct_t g_slots[FDL_DIRECT_MAX];
+
+/* Run an IFUNC resolver the way ld.so would, the foreign libc's included:
+ * we only get here once its runtime is up. */
+static unsigned long sym_addr(unsigned long base, const Elf_Sym *s)
+{
+    unsigned long addr = base + s->st_value;
+
+    if (ELF_ST_TYPE(s->st_info) == STT_GNU_IFUNC)
+        addr = ((unsigned long (*)(unsigned long))addr)(z_getauxval(AT_HWCAP));
+    return addr;
+}
+
+/* Where symbol symi of h binds: itself, the exports, the foreign libc.
+ * Returns -1 when it binds nowhere and isn't weak, or is TLS. */
+static int bind(fdl_direct_t *h, unsigned long symi, unsigned long *out)
+{
+    Elf_Sym *sym = &h->mod.dynsym[symi], *s;
+    const char *name = h->mod.dynstr + sym->st_name;
+    const fdl_export_t *e;
+    fdl_mod_t *libc;
+
+    if (symi == 0)
+    {
+        *out = 0;
+        return 0;
+    }
+    if (ELF_ST_TYPE(sym->st_info) == STT_TLS)
+    {
+        z_warn("fdl_direct: TLS symbol %s\n", name);
+        return -1;
+    }
+    if (sym->st_shndx != SHN_UNDEF)
+    {
+        *out = sym_addr(h->base, sym);
+        return 0;
+    }
+    for (e = h->exports; e && e->name; e++)
+    {
+        if (!z_strcmp(e->name, name))
+        {
+            *out = (unsigned long)e->addr;
+            return 0;
+        }
+    }
+    if ((libc = fdl_libc_mod()) != NULL &&
+        ((s = fdl_lookup_gnu(libc, name)) != NULL || (s = fdl_lookup_sysv(libc, name)) != NULL) &&
+        ELF_ST_TYPE(s->st_info) != STT_TLS)
+    {
+        *out = sym_addr(libc->base, s);
+        return 0;
+    }
+    *out = 0;
+    if (ELF_ST_BIND(sym->st_info) == STB_WEAK)
+        return 0;
+    z_warn("fdl_direct: undefined symbol %s\n", name);
+    return -1;
+}
+
+/* REL keeps the addend in place, pass rela = 0 and addend = 0. */
+static int reloc_one(fdl_direct_t *h, unsigned long type, unsigned long symi,
+                     Elf_Addr *where, Elf_Addr addend, int rela)
+{
+    unsigned long s;
+
+    switch (type)
+    {
+    case R_NONE:
+        return 0;
+    case R_RELATIVE:
+        *where = h->base + (rela ? addend : *where);
+        return 0;
+    case R_ABS:
+        if (bind(h, symi, &s) < 0)
+            return -1;
+        *where = s + (rela ? addend : *where);
+        return 0;
+    case R_GLOB_DAT:
+    case R_JUMP_SLOT:
+        if (bind(h, symi, &s) < 0)
+            return -1;
+        *where = s + addend;
+        return 0;
+    }
+    z_warn("fdl_direct: unsupported relocation type %lu\n", type);
+    return -1;
+}
+
+static int reloc_table(fdl_direct_t *h, unsigned long addr, unsigned long size, int rela)
+{
+    if (rela)
+    {
+        for (Elf_Rela *r = (Elf_Rela *)addr; (unsigned long)(r + 1) <= addr + size; r++)
+            if (reloc_one(h, ELF_R_TYPE(r->r_info), ELF_R_SYM(r->r_info),
+                          (Elf_Addr *)(h->base + r->r_offset), r->r_addend, 1) < 0)
+                return -1;
+    }
+    else
+    {
+        for (Elf_Rel *r = (Elf_Rel *)addr; (unsigned long)(r + 1) <= addr + size; r++)
+            if (reloc_one(h, ELF_R_TYPE(r->r_info), ELF_R_SYM(r->r_info),
+                          (Elf_Addr *)(h->base + r->r_offset), 0, 0) < 0)
+                return -1;
+    }
+    return 0;
+}
+
+/* An even entry is an address to relocate, an odd one a bitmap of the
+ * next word size - 1 words after it. */
+static void reloc_relr(unsigned long base, unsigned long addr, unsigned long size)
+{
+    const unsigned bits = 8 * sizeof(Elf_Addr) - 1;
+    Elf_Addr *where = NULL;
+
+    for (Elf_Addr *r = (Elf_Addr *)addr; (unsigned long)(r + 1) <= addr + size; r++)
+    {
+        Elf_Addr e = *r;
+
+        if (!(e & 1))
+        {
+            where = (Elf_Addr *)(base + e);
+            *where++ += base;
+            continue;
+        }
+        for (unsigned i = 0; (e >>= 1) != 0; i++)
+            if (e & 1)
+                where[i] += base;
+        where += bits;
+    }
+}
+
+static void read_dyn(fdl_direct_t *h, dyn_info_t *di)
+{
+    z_memset(di, 0, sizeof(*di));
+    for (Elf_Dyn *d = h->mod.dyn; d->d_tag != DT_NULL; d++)
+    {
+        unsigned long ptr = h->base + d->d_un.d_ptr, val = d->d_un.d_val;
+
+        switch (d->d_tag)
+        {
+        case DT_REL:
+            di->rel = ptr;
+            break;
+        case DT_RELSZ:
+            di->relsz = val;
+            break;
+        case DT_RELA:
+            di->rela = ptr;
+            break;
+        case DT_RELASZ:
+            di->relasz = val;
+            break;
+        case DT_RELR:
+            di->relr = ptr;
+            break;
+        case DT_RELRSZ:
+            di->relrsz = val;
+            break;
+        case DT_JMPREL:
+            di->jmprel = ptr;
+            break;
+        case DT_PLTRELSZ:
+            di->pltrelsz = val;
+            break;
+        case DT_PLTREL:
+            di->pltrel = val;
+            break;
+        case DT_INIT:
+            di->init = ptr;
+            break;
+        case DT_INIT_ARRAY:
+            di->init_array = ptr;
+            break;
+        case DT_INIT_ARRAYSZ:
+            di->init_arraysz = val;
+            break;
+        case DT_FINI:
+            di->fini = ptr;
+            break;
+        case DT_FINI_ARRAY:
+            di->fini_array = ptr;
+            break;
+        case DT_FINI_ARRAYSZ:
+            di->fini_arraysz = val;
+            break;
+        case DT_TEXTREL:
+            di->textrel = 1;
+            break;
+        case DT_FLAGS:
+            if (val & (DF_TEXTREL | DF_STATIC_TLS))
+                di->textrel = 1;
+            break;
+        case DT_NEEDED:
+            z_debug("fdl_direct: not loading %s\n", h->mod.dynstr ? h->mod.dynstr + val : "?");
+            break;
+        }
+    }
+}
+
+/* Image size, 0 if we can't load it, with the reason logged. */
+static unsigned long check_phdrs(const char *path, Elf_Ehdr *eh, Elf_Phdr *ph)
+{
+    unsigned long lo = ~0UL, hi = 0;
+
+    for (int i = 0; i < eh->e_phnum; i++)
+    {
+        if (ph[i].p_type == PT_TLS)
+        {
+            z_warn("fdl_direct: %s: PT_TLS not supported\n", path);
+            return 0;
+        }
+        if (ph[i].p_type != PT_LOAD)
+            continue;
+        if (ph[i].p_vaddr < lo)
+            lo = ph[i].p_vaddr;
+        if (ph[i].p_vaddr + ph[i].p_memsz > hi)
+            hi = ph[i].p_vaddr + ph[i].p_memsz;
+    }
+    if (TRUNC_PG(lo) != 0)
+    {
+        z_warn("fdl_direct: %s: not linked at address 0\n", path);
+        return 0;
+    }
+    return ROUND_PG(hi);
+}
+
+static void seal_relro(fdl_direct_t *h, Elf_Phdr *ph, int phnum)
+{
+    for (int i = 0; i < phnum; i++)
+    {
+        unsigned long start, end;
+
+        if (ph[i].p_type != PT_GNU_RELRO)
+            continue;
+        start = TRUNC_PG(h->base + ph[i].p_vaddr);
+        end = TRUNC_PG(h->base + ph[i].p_vaddr + ph[i].p_memsz);
+        if (end > start)
+            z_mprotect((void *)start, end - start, PROT_READ);
+    }
+}
+
+static fdl_direct_t *claim(void)
+{
+    for (int i = 0; i < FDL_DIRECT_MAX; i++)
+    {
+        uint32_t expect = S_FREE;
+        if (__atomic_compare_exchange_n(&g_slots[i].state, &expect, S_USED, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return &g_slots[i];
+    }
+    return NULL;
+}
+
+static void release(fdl_direct_t *h)
+{
+    __atomic_store_n(&h->state, S_FREE, __ATOMIC_RELEASE);
+}
+
+fdl_direct_t *fdl_direct_open(const char *path, const fdl_export_t *exports)
+{
+    Elf_Ehdr eh;
+    Elf_Phdr ph[MAX_PHDR];
+    fdl_direct_t *h;
+    dyn_info_t di;
+    int fd, ok;
+
+    if ((h = claim()) == NULL)
+        return NULL;
+    if ((fd = z_open(path, O_RDONLY)) < 0)
+    {
+        z_warn("fdl_direct: can't open %s\n", path);
+        goto err;
+    }
+    ok = z_read(fd, &eh, sizeof(eh)) == sizeof(eh) &&
+         eh.e_ident[EI_MAG0] == ELFMAG0 && eh.e_ident[EI_MAG1] == ELFMAG1 &&
+         eh.e_ident[EI_MAG2] == ELFMAG2 && eh.e_ident[EI_MAG3] == ELFMAG3 &&
+         eh.e_ident[EI_CLASS] == ELFCLASS && eh.e_machine == Z_EM &&
+         eh.e_type == ET_DYN && eh.e_phentsize == sizeof(Elf_Phdr) &&
+         eh.e_phnum <= MAX_PHDR &&
+         z_lseek(fd, eh.e_phoff, SEEK_SET) == (int)eh.e_phoff &&
+         z_read(fd, ph, eh.e_phnum * sizeof(Elf_Phdr)) == (ssize_t)(eh.e_phnum * sizeof(Elf_Phdr)) &&
+         (h->size = check_phdrs(path, &eh, ph)) != 0;
+    if (!ok || (h->base = loadelf_anon(fd, &eh, ph)) == (unsigned long)-1)
+    {
+        z_warn("fdl_direct: can't load %s\n", path);
+        z_close(fd);
+        goto err;
+    }
+    z_perfmap_image(path, fd, &eh, ph, h->base);
+    z_prof_image(path, &eh, ph, h->base);
+    z_close(fd);
+
+    z_memset(&h->mod, 0, sizeof(h->mod));
+    h->exports = exports;
+    if (fdl_mod_init(&h->mod, h->base) < 0)
+        goto err_unmap;
+    read_dyn(h, &di);
+    if (di.textrel)
+    {
+        z_warn("fdl_direct: %s needs text relocations or static TLS\n", path);
+        goto err_unmap;
+    }
+
+    /* Some linkers count the PLT relocations into DT_REL(A)SZ, and a REL
+     * RELATIVE applied twice adds the base twice. */
+    if (di.jmprel && di.jmprel > di.rel && di.jmprel < di.rel + di.relsz)
+        di.relsz = di.jmprel - di.rel;
+    if (di.jmprel && di.jmprel > di.rela && di.jmprel < di.rela + di.relasz)
+        di.relasz = di.jmprel - di.rela;
+    if (di.relr)
+        reloc_relr(h->base, di.relr, di.relrsz);
+    if ((di.rel && reloc_table(h, di.rel, di.relsz, 0) < 0) ||
+        (di.rela && reloc_table(h, di.rela, di.relasz, 1) < 0) ||
+        (di.jmprel && reloc_table(h, di.jmprel, di.pltrelsz, di.pltrel == DT_RELA) < 0))
+    {
+        z_warn("fdl_direct: can't relocate %s\n", path);
+        goto err_unmap;
+    }
+    seal_relro(h, ph, eh.e_phnum);
+
+    h->fini = di.fini;
+    h->fini_array = (Elf_Addr *)di.fini_array;
+    h->fini_count = di.fini_array ? di.fini_arraysz / sizeof(Elf_Addr) : 0;
+    /* glibc passes argc, argv, envp, we have no argv for it. */
+    if (di.init)
+        ((init_fn_t)di.init)(0, NULL, z_environ);
+    for (unsigned long i = 0; di.init_array && i < di.init_arraysz / sizeof(Elf_Addr); i++)
+    {
+        Elf_Addr fn = ((Elf_Addr *)di.init_array)[i];
+        if (fn != 0 && fn != (Elf_Addr)-1)
+            ((init_fn_t)fn)(0, NULL, z_environ);
+    }
+    z_debug("fdl_direct: %s at 0x%lx\n", path, h->base);
+    return h;
+
+err_unmap:
+    z_munmap((void *)h->base, h->size);
+err:
+    release(h);
+    return NULL;
+}
+
+void *fdl_direct_sym(fdl_direct_t *h, const char *name)
+{
+    Elf_Sym *s = fdl_lookup_gnu(&h->mod, name);
+
+    if (!s)
+        s = fdl_lookup_sysv(&h->mod, name);
+    if (!s || ELF_ST_TYPE(s->st_info) == STT_TLS)
+        return NULL;
+    return (void *)sym_addr(h->base, s);
+}
+
+void fdl_direct_close(fdl_direct_t *h)
+{
+    for (unsigned long i = h->fini_count; i-- > 0;)
+    {
+        Elf_Addr fn = h->fini_array[i];
+        if (fn != 0 && fn != (Elf_Addr)-1)
+            ((void (*)(void))fn)();
+    }
+    if (h->fini)
+        ((void (*)(void))h->fini)();
+    z_munmap((void *)h->base, h->size);
+    release(h);
+}
@@ -0,0 +1,32 @@
+#ifndef FDL_DIRECT_H
+#define FDL_DIRECT_H
+
+/*
+ * Loading self-contained shared objects without ld.so. The object is
+ * mapped with loadelf_anon(), its relative (including DT_RELR), GLOB_DAT,
+ * JUMP_SLOT and absolute relocations are applied right away, PT_GNU_RELRO
+ * is sealed and DT_INIT/DT_INIT_ARRAY run. Imports bind to the caller's
+ * exports first, then to the foreign libc once fdl_resolve_from_maps() has
+ * found it. DT_NEEDED is not followed: every import that is not weak must
+ * bind. TLS, IRELATIVE, COPY and text relocations are refused.
+ */
+
+#define FDL_DIRECT_MAX 32
+
+typedef struct
+{
+    const char *name;
+    void *addr;
+} fdl_export_t;
+
+typedef struct fdl_direct fdl_direct_t;
+
+/* exports ends with a NULL name, it may be NULL. NULL on failure, the
+ * reason is logged at warn level. */
+fdl_direct_t *fdl_direct_open(const char *path, const fdl_export_t *exports);
+/* A symbol the object defines, NULL if there is none. */
+void *fdl_direct_sym(fdl_direct_t *h, const char *name);
+/* Run DT_FINI_ARRAY and DT_FINI, unmap and release h. */
+void fdl_direct_close(fdl_direct_t *h);
+
+#endif /* FDL_DIRECT_H */
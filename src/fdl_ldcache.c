@@ -0,0 +1,328 @@
+#include "fdl_ldcache.h"
+#include "fdl_resolve.h"
+#include "z_once.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+
+#define CACHEMAGIC "ld.so-1.7.0"
+#define CACHEMAGIC_NEW "glibc-ld.so.cache"
+#define CACHE_VERSION "1.1"
+
+/* ldconfig's entry flags, see glibc's sysdeps/generic/ldconfig.h */
+#define FLAG_ELF_LIBC6 0x0003
+#define FLAG_X8664_LIB64 0x0300
+#define FLAG_ARM_LIBHF 0x0900
+#define FLAG_AARCH64_LIB64 0x0a00
+#define FLAG_ARM_LIBSF 0x0b00
+
+/* What ld.so's _dl_cache_check_flags() accepts on each arch. */
+#if defined(__x86_64__)
+#define FLAGS_OK(f) ((f) == (FLAG_X8664_LIB64 | FLAG_ELF_LIBC6))
+#elif defined(__aarch64__)
+#define FLAGS_OK(f) ((f) == (FLAG_AARCH64_LIB64 | FLAG_ELF_LIBC6))
+#elif defined(__arm__) && defined(__ARM_PCS_VFP)
+#define FLAGS_OK(f) ((f) == (FLAG_ARM_LIBHF | FLAG_ELF_LIBC6) || (f) == FLAG_ELF_LIBC6)
+#elif defined(__arm__)
+#define FLAGS_OK(f) ((f) == (FLAG_ARM_LIBSF | FLAG_ELF_LIBC6) || (f) == FLAG_ELF_LIBC6)
+#else
+#define FLAGS_OK(f) ((f) == 1 || (f) == FLAG_ELF_LIBC6)
+#endif
+
+struct file_entry
+{
+    int32_t flags;
+    uint32_t key, value;
+};
+
+struct cache_file
+{
+    char magic[sizeof(CACHEMAGIC) - 1];
+    uint32_t nlibs;
+    struct file_entry libs[];
+};
+
+struct file_entry_new
+{
+    int32_t flags;
+    uint32_t key, value;
+    uint32_t osversion;
+    uint64_t hwcap;
+};
+
+struct cache_file_new
+{
+    char magic[sizeof(CACHEMAGIC_NEW) - 1];
+    char version[sizeof(CACHE_VERSION) - 1];
+    uint32_t nlibs;
+    uint32_t len_strings;
+    uint8_t flags;
+    uint8_t padding_unused[3];
+    uint32_t extension_offset;
+    uint32_t unused[3];
+    struct file_entry_new libs[];
+};
+
+#define MEMO_SLOTS 64
+#define MEMO_NAME 64
+
+enum
+{
+    MEMO_EMPTY,
+    MEMO_BUSY,
+    MEMO_VALID,
+};
+
+/* Slots are claimed once and never reused, so readers need no lock. */
+typedef struct
+{
+    uint32_t state;
+    uint32_t hash;
+    const char *path; /* NULL caches a miss */
+    char name[MEMO_NAME];
+} memo_t;
+
+typedef struct
+{
+    const char *data; /* string offsets are relative to this */
+    unsigned long size;
+    const char *entries;
+    unsigned long entsz;
+    uint32_t nlibs;
+} cache_t;
+
+static z_once_t g_once = Z_ONCE_INIT;
+static int g_ok; /* g_cache is set up */
+static cache_t g_cache;
+static memo_t g_memo[MEMO_SLOTS];
+
+/* ld.so's _dl_cache_libcmp(): runs of digits compare numerically. */
+static int libcmp(const char *p1, const char *p2)
+{
+    while (*p1 != '\0')
+    {
+        if (*p1 >= '0' && *p1 <= '9')
+        {
+            if (*p2 >= '0' && *p2 <= '9')
+            {
+                int val1 = *p1++ - '0';
+                int val2 = *p2++ - '0';
+                while (*p1 >= '0' && *p1 <= '9')
+                    val1 = val1 * 10 + *p1++ - '0';
+                while (*p2 >= '0' && *p2 <= '9')
+                    val2 = val2 * 10 + *p2++ - '0';
+                if (val1 != val2)
+                    return val1 - val2;
+            }
+            else
+                return 1;
+        }
+        else if (*p2 >= '0' && *p2 <= '9')
+            return -1;
+        else if (*p1 != *p2)
+            return *p1 - *p2;
+        else
+        {
+            ++p1;
+            ++p2;
+        }
+    }
+    return *p1 - *p2;
+}
+
+static int cache_map(cache_t *c)
+{
+    const struct cache_file *old;
+    const struct cache_file_new *new = NULL;
+    unsigned long size, off;
+    char *map;
+    int fd;
+
+    if ((fd = z_open(LDCACHE_PATH, O_RDONLY)) < 0)
+        return -1;
+    size = (unsigned long)z_lseek(fd, 0, SEEK_END);
+    map = z_mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    z_close(fd);
+    if (map == (void *)-1)
+        return -1;
+
+    old = (const struct cache_file *)map;
+    if (size >= sizeof(*old) && !z_memcmp(old->magic, CACHEMAGIC, sizeof(old->magic)))
+    {
+        /* Old layout, possibly followed by the new one. */
+        off = sizeof(*old) + old->nlibs * sizeof(struct file_entry);
+        if (off > size)
+            goto bad;
+        c->data = (const char *)&old->libs[old->nlibs];
+        c->entries = (const char *)old->libs;
+        c->entsz = sizeof(struct file_entry);
+        c->nlibs = old->nlibs;
+        off = (off + __alignof__(struct cache_file_new) - 1) &
+              ~(__alignof__(struct cache_file_new) - 1);
+        if (off + sizeof(*new) <= size)
+            new = (const struct cache_file_new *)(map + off);
+    }
+    else
+        new = (const struct cache_file_new *)map;
+
+    if (new && (unsigned long)((const char *)new - map) + sizeof(*new) <= size &&
+        !z_memcmp(new->magic, CACHEMAGIC_NEW, sizeof(new->magic)) &&
+        !z_memcmp(new->version, CACHE_VERSION, sizeof(new->version)))
+    {
+        c->data = (const char *)new;
+        c->entries = (const char *)new->libs;
+        c->entsz = sizeof(struct file_entry_new);
+        c->nlibs = new->nlibs;
+    }
+    else if (c->data == NULL)
+        goto bad;
+
+    c->size = size - (c->data - map);
+    if ((unsigned long)(c->entries - map) + c->nlibs * c->entsz > size)
+        goto bad;
+    return 0;
+bad:
+    z_munmap(map, size);
+    z_memset(c, 0, sizeof(*c));
+    return -1;
+}
+
+static const char *entry_str(const cache_t *c, uint32_t off)
+{
+    /* Offsets come from the file, don't trust them past the mapping. */
+    return off < c->size ? c->data + off : "";
+}
+
+static const char *cache_search(const cache_t *c, const char *name)
+{
+    const struct file_entry *e;
+    long left = 0, right = (long)c->nlibs - 1, mid = 0;
+    int cmp = -1;
+
+    /* ldconfig sorts the entries in descending libcmp() order. */
+    while (left <= right)
+    {
+        mid = (left + right) >> 1;
+        e = (const struct file_entry *)(c->entries + mid * c->entsz);
+        cmp = libcmp(name, entry_str(c, e->key));
+        if (cmp == 0)
+            break;
+        if (cmp < 0)
+            left = mid + 1;
+        else
+            right = mid - 1;
+    }
+    if (cmp != 0)
+        return NULL;
+
+    /* Back up to the first of the equal keys, then take the first one
+     * we can use. Both layouts start with flags, key and value. */
+    while (mid > 0)
+    {
+        e = (const struct file_entry *)(c->entries + (mid - 1) * c->entsz);
+        if (libcmp(name, entry_str(c, e->key)) != 0)
+            break;
+        mid--;
+    }
+    for (; mid < (long)c->nlibs; mid++)
+    {
+        e = (const struct file_entry *)(c->entries + mid * c->entsz);
+        if (libcmp(name, entry_str(c, e->key)) != 0)
+            break;
+        if (!FLAGS_OK(e->flags))
+            continue;
+        if (c->entsz == sizeof(struct file_entry_new) &&
+            ((const struct file_entry_new *)e)->hwcap != 0)
+            continue;
+        if (e->value < c->size)
+            return entry_str(c, e->value);
+    }
+    return NULL;
+}
+
+static uint32_t name_hash(const char *s)
+{
+    uint32_t h = 5381;
+    for (unsigned char ch; (ch = *s++) != 0;)
+        h = (h * 33) + ch;
+    return h;
+}
+
+static int memo_get(uint32_t h, const char *name, const char **path)
+{
+    for (int i = 0; i < MEMO_SLOTS; i++)
+    {
+        memo_t *m = &g_memo[(h + i) & (MEMO_SLOTS - 1)];
+        uint32_t st = __atomic_load_n(&m->state, __ATOMIC_ACQUIRE);
+
+        if (st == MEMO_EMPTY)
+            return 0;
+        if (st == MEMO_VALID && m->hash == h && !z_strcmp(m->name, name))
+        {
+            *path = m->path;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void memo_put(uint32_t h, const char *name, const char *path)
+{
+    size_t len;
+
+    for (len = 0; name[len]; len++)
+        if (len == MEMO_NAME - 1)
+            return;
+    for (int i = 0; i < MEMO_SLOTS; i++)
+    {
+        memo_t *m = &g_memo[(h + i) & (MEMO_SLOTS - 1)];
+        uint32_t st = MEMO_EMPTY;
+
+        if (!__atomic_compare_exchange_n(&m->state, &st, MEMO_BUSY, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+        m->hash = h;
+        m->path = path;
+        z_memcpy(m->name, name, len + 1);
+        __atomic_store_n(&m->state, MEMO_VALID, __ATOMIC_RELEASE);
+        return;
+    }
+}
+
+static void cache_init(void *arg)
+{
+    (void)arg;
+    g_ok = cache_map(&g_cache) == 0;
+}
+
+static const cache_t *cache_get(void)
+{
+    z_once(&g_once, cache_init, NULL);
+    return g_ok ? &g_cache : NULL;
+}
+
+const char *fdl_ldcache_lookup(const char *soname)
+{
+    const cache_t *c = cache_get();
+    uint32_t h = name_hash(soname);
+    const char *path;
+
+    if (!c)
+        return NULL;
+    if (memo_get(h, soname, &path))
+        return path;
+    path = cache_search(c, soname);
+    memo_put(h, soname, path);
+    return path;
+}
+
+void *fdl_dlopen_cached(const char *name, int flags)
+{
+    void *(*my_dlopen)(const char *, int) = (void *(*)(const char *, int))fdl_dlopen_sym(NULL);
+    const char *path = NULL, *p;
+
+    for (p = name; name && *p && *p != '/'; p++)
+        ;
+    if (name && !*p)
+        path = fdl_ldcache_lookup(name);
+    return my_dlopen(path ? path : name, flags);
+}
@@ -0,0 +1,25 @@
+#ifndef FDL_LDCACHE_H
+#define FDL_LDCACHE_H
+
+/*
+ * Static-side reader for glibc's /etc/ld.so.cache (both the old
+ * "ld.so-1.7.0" layout and the new "glibc-ld.so.cache1.1" one). The file is
+ * mapped once and binary searched the way ld.so does it, answers (misses
+ * included) are memoized. glibc-hwcaps entries are skipped, we always
+ * answer with the baseline library.
+ */
+
+#ifndef LDCACHE_PATH
+#define LDCACHE_PATH "/etc/ld.so.cache"
+#endif
+
+/* Absolute path of soname, NULL if the cache doesn't list it (or there is
+ * no usable cache, e.g. on musl). The string lives as long as the process. */
+const char *fdl_ldcache_lookup(const char *soname);
+
+/* Foreign dlopen() that turns a bare soname into its cached absolute path
+ * first, so ld.so doesn't probe the search path. Unlike ld.so, the cache
+ * takes precedence over LD_LIBRARY_PATH and the caller's DT_RUNPATH. */
+void *fdl_dlopen_cached(const char *name, int flags);
+
+#endif /* FDL_LDCACHE_H */
@@ -0,0 +1,327 @@
+#include "fdl_pool.h"
+#include "fdl_resolve.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+#include <limits.h>
+
+#define QUEUE_MASK (FDL_POOL_QUEUE_LEN - 1)
+#define CPUSET_BYTES 128 /* 1024 CPUs, same as glibc's cpu_set_t */
+
+typedef int (*pthread_create_t)(unsigned long *, const void *,
+                                void *(*)(void *), void *);
+typedef int (*pthread_join_t)(unsigned long, void **);
+typedef int (*pthread_setaffinity_t)(unsigned long, size_t, const void *);
+
+/* Bounded MPMC queue, each cell's seq tells whose turn it is. */
+typedef struct
+{
+    uint32_t seq;
+    fdl_task_fn fn;
+    void *arg;
+} cell_t;
+
+typedef struct
+{
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    cell_t cells[FDL_POOL_QUEUE_LEN];
+} queue_t;
+
+typedef struct
+{
+    queue_t q;
+    fdl_pool_t *pool;
+    unsigned long thread;
+    unsigned idx;
+    int cpu;
+    fdl_pool_stats_t st;
+} __attribute__((aligned(64))) worker_t;
+
+struct fdl_pool
+{
+    unsigned nworkers;
+    uint32_t stop;
+    /* Bumped on every submit, idle workers sleep on it. */
+    uint32_t work_seq;
+    uint32_t sleepers;
+    /* Submitted but not finished tasks, fdl_pool_wait() sleeps on it. */
+    uint32_t pending;
+    uint32_t pending_waiters;
+    uint32_t next;
+    pthread_join_t join;
+    pthread_setaffinity_t setaffinity;
+    worker_t workers[FDL_POOL_MAX_WORKERS];
+};
+
+static void queue_init(queue_t *q)
+{
+    for (uint32_t i = 0; i < FDL_POOL_QUEUE_LEN; i++)
+        q->cells[i].seq = i;
+}
+
+static int queue_push(queue_t *q, fdl_task_fn fn, void *arg)
+{
+    uint32_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    cell_t *c;
+
+    for (;;)
+    {
+        c = &q->cells[pos & QUEUE_MASK];
+        int32_t diff = (int32_t)(__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return -1; /* full */
+        else
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+    c->fn = fn;
+    c->arg = arg;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int queue_pop(queue_t *q, fdl_task_fn *fn, void **arg)
+{
+    uint32_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    cell_t *c;
+
+    for (;;)
+    {
+        c = &q->cells[pos & QUEUE_MASK];
+        int32_t diff = (int32_t)(__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return -1; /* empty */
+        else
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+    *fn = c->fn;
+    *arg = c->arg;
+    __atomic_store_n(&c->seq, pos + FDL_POOL_QUEUE_LEN, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void task_done(fdl_pool_t *p)
+{
+    if (__atomic_sub_fetch(&p->pending, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&p->pending_waiters, __ATOMIC_SEQ_CST))
+        z_futex_wake(&p->pending, INT_MAX);
+}
+
+/* Run one task: our own queue first, then steal from the siblings.
+ * w is NULL for the thread blocked in fdl_pool_wait(). */
+static int run_one(fdl_pool_t *p, worker_t *w)
+{
+    unsigned start = w ? w->idx : 0, i = start;
+    fdl_task_fn fn;
+    void *arg;
+
+    do
+    {
+        if (queue_pop(&p->workers[i].q, &fn, &arg) == 0)
+        {
+            fn(arg);
+            if (w)
+            {
+                w->st.executed++;
+                if (i != start)
+                    w->st.stolen++;
+            }
+            task_done(p);
+            return 1;
+        }
+        if (++i == p->nworkers)
+            i = 0;
+    } while (i != start);
+    return 0;
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *w = arg;
+    fdl_pool_t *p = w->pool;
+    uint32_t seq;
+
+    if (w->cpu >= 0 && !p->setaffinity)
+    {
+        unsigned char mask[CPUSET_BYTES];
+        z_memset(mask, 0, sizeof(mask));
+        mask[w->cpu >> 3] = 1 << (w->cpu & 7);
+        z_sched_setaffinity(0, sizeof(mask), mask);
+    }
+
+    for (;;)
+    {
+        seq = __atomic_load_n(&p->work_seq, __ATOMIC_ACQUIRE);
+        if (run_one(p, w))
+            continue;
+        if (__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE))
+            break;
+        __atomic_fetch_add(&p->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&p->work_seq, __ATOMIC_SEQ_CST) == seq)
+            z_futex_wait(&p->work_seq, seq);
+        __atomic_fetch_sub(&p->sleepers, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void kick(fdl_pool_t *p, int nr)
+{
+    __atomic_fetch_add(&p->work_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&p->sleepers, __ATOMIC_SEQ_CST))
+        z_futex_wake(&p->work_seq, nr);
+}
+
+void *fdl_pthread_sym(const char *name)
+{
+    void *(*my_dlopen)(const char *, int) = (void *(*)(const char *, int))fdl_dlopen_sym(NULL);
+    void *(*my_dlsym)(void *, const char *) = (void *(*)(void *, const char *))fdl_dlsym_sym(NULL);
+    void *s, *h;
+
+    if ((s = fdl_default_sym(name)) != NULL)
+        return s;
+    /* glibc before 2.34 keeps threads out of libc.so */
+    if (!my_dlopen || !my_dlsym || !(h = my_dlopen("libpthread.so.0", RTLD_NOW)))
+        return NULL;
+    return my_dlsym(h, name);
+}
+
+fdl_pool_t *fdl_pool_create(unsigned nworkers, unsigned flags)
+{
+    pthread_create_t create = (pthread_create_t)fdl_pthread_sym("pthread_create");
+    unsigned char mask[CPUSET_BYTES];
+    int cpus[FDL_POOL_MAX_WORKERS], ncpus = 0, n;
+    fdl_pool_t *p;
+    unsigned i;
+
+    if (!create)
+        return NULL;
+
+    z_memset(mask, 0, sizeof(mask));
+    n = z_sched_getaffinity(0, sizeof(mask), mask);
+    for (i = 0; n > 0 && i < (unsigned)n * 8 && ncpus < FDL_POOL_MAX_WORKERS; i++)
+        if (mask[i >> 3] & (1 << (i & 7)))
+            cpus[ncpus++] = i;
+    if (ncpus == 0)
+        cpus[ncpus++] = 0;
+    if (nworkers == 0)
+        nworkers = ncpus;
+    if (nworkers > FDL_POOL_MAX_WORKERS)
+        nworkers = FDL_POOL_MAX_WORKERS;
+
+    p = z_mmap(NULL, sizeof(*p), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == (void *)-1)
+        return NULL;
+    p->nworkers = nworkers;
+    p->join = (pthread_join_t)fdl_pthread_sym("pthread_join");
+    if (flags & FDL_POOL_PIN)
+        p->setaffinity = (pthread_setaffinity_t)fdl_pthread_sym("pthread_setaffinity_np");
+
+    for (i = 0; i < nworkers; i++)
+    {
+        worker_t *w = &p->workers[i];
+        unsigned long cpu;
+
+        queue_init(&w->q);
+        w->pool = p;
+        w->idx = i;
+        z_udivmod(i, ncpus, &cpu);
+        w->cpu = (flags & FDL_POOL_PIN) ? cpus[cpu] : -1;
+    }
+    /* Queues must be ready before the first worker starts stealing. */
+    for (i = 0; i < nworkers; i++)
+    {
+        worker_t *w = &p->workers[i];
+
+        if (create(&w->thread, NULL, worker_main, w) != 0)
+        {
+            p->nworkers = i;
+            fdl_pool_destroy(p);
+            return NULL;
+        }
+        if (p->setaffinity)
+        {
+            z_memset(mask, 0, sizeof(mask));
+            mask[w->cpu >> 3] = 1 << (w->cpu & 7);
+            p->setaffinity(w->thread, sizeof(mask), mask);
+        }
+    }
+    return p;
+}
+
+unsigned fdl_pool_size(fdl_pool_t *p)
+{
+    return p->nworkers;
+}
+
+void fdl_pool_submit(fdl_pool_t *p, fdl_task_fn fn, void *arg)
+{
+    unsigned long i;
+    unsigned n;
+
+    __atomic_fetch_add(&p->pending, 1, __ATOMIC_RELAXED);
+    z_udivmod(__atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED), p->nworkers, &i);
+    for (n = 0; n < p->nworkers; n++)
+    {
+        if (queue_push(&p->workers[i].q, fn, arg) == 0)
+        {
+            kick(p, 1);
+            return;
+        }
+        if (++i == p->nworkers)
+            i = 0;
+    }
+    /* Every queue is full, back-pressure the submitter. */
+    fn(arg);
+    task_done(p);
+}
+
+void fdl_pool_wait(fdl_pool_t *p)
+{
+    uint32_t v;
+
+    while ((v = __atomic_load_n(&p->pending, __ATOMIC_ACQUIRE)) != 0)
+    {
+        if (p->nworkers && run_one(p, NULL))
+            continue;
+        __atomic_fetch_add(&p->pending_waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&p->pending, __ATOMIC_SEQ_CST) == v)
+            z_futex_wait(&p->pending, v);
+        __atomic_fetch_sub(&p->pending_waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void fdl_pool_stats(fdl_pool_t *p, unsigned worker, fdl_pool_stats_t *st)
+{
+    if (worker >= p->nworkers)
+    {
+        z_memset(st, 0, sizeof(*st));
+        return;
+    }
+    st->executed = __atomic_load_n(&p->workers[worker].st.executed, __ATOMIC_RELAXED);
+    st->stolen = __atomic_load_n(&p->workers[worker].st.stolen, __ATOMIC_RELAXED);
+}
+
+void fdl_pool_destroy(fdl_pool_t *p)
+{
+    fdl_pool_wait(p);
+    __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+    kick(p, INT_MAX);
+    for (unsigned i = 0; i < p->nworkers; i++)
+        if (p->join)
+            p->join(p->workers[i].thread, NULL);
+    /* Without pthread_join we can't tell when the stacks are unused. */
+    if (p->join)
+        z_munmap(p, sizeof(*p));
+}
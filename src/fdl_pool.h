@@ -0,0 +1,49 @@
+#ifndef FDL_POOL_H
+#define FDL_POOL_H
+
+#include <stdint.h>
+
+/*
+ * Worker pool on foreign pthreads. Workers are created with the foreign
+ * pthread_create, so tasks run with a proper foreign TLS and may call into
+ * the foreign libc and plugins. The task body itself is static-side code.
+ *
+ * Every worker owns a bounded MPMC queue. Submission spreads tasks round
+ * robin, an idle worker steals from its siblings before going to sleep.
+ * Only usable once the foreign runtime is up (from an fdl_set_main() hook).
+ *
+ * Workers return from their foreign thread function on fdl_pool_destroy().
+ * z_exit() and z_errx() end the whole process, a pool still alive then
+ * goes down with it: queued tasks are dropped and running ones cut short.
+ */
+
+#define FDL_POOL_MAX_WORKERS 64
+#define FDL_POOL_QUEUE_LEN 256 /* per worker, power of two */
+
+/* fdl_pool_create() flags */
+#define FDL_POOL_PIN 0x1 /* pin worker i to the i-th CPU we may run on */
+
+typedef void (*fdl_task_fn)(void *arg);
+typedef struct fdl_pool fdl_pool_t;
+
+typedef struct
+{
+    unsigned long executed;
+    unsigned long stolen;
+} fdl_pool_stats_t;
+
+/* Foreign pthread API entry, also looks into libpthread.so.0 when needed. */
+void *fdl_pthread_sym(const char *name);
+
+/* nworkers == 0 means one worker per CPU in our affinity mask. */
+fdl_pool_t *fdl_pool_create(unsigned nworkers, unsigned flags);
+unsigned fdl_pool_size(fdl_pool_t *p);
+/* Queue a task, runs it inline when every queue is full. */
+void fdl_pool_submit(fdl_pool_t *p, fdl_task_fn fn, void *arg);
+/* Wait for every submitted task, the caller helps draining the queues. */
+void fdl_pool_wait(fdl_pool_t *p);
+void fdl_pool_stats(fdl_pool_t *p, unsigned worker, fdl_pool_stats_t *st);
+/* Wait, stop and join the workers, then release the pool. */
+void fdl_pool_destroy(fdl_pool_t *p);
+
+#endif /* FDL_POOL_H */
@@ -0,0 +1,259 @@
+#include "fdl_prefetch.h"
+#include "fdl_ldcache.h"
+#include "elf_loader.h"
+#include "z_elf.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+
+#if defined(__x86_64__)
+#define MULTIARCH "x86_64-linux-gnu"
+#elif defined(__i386__)
+#define MULTIARCH "i386-linux-gnu"
+#elif defined(__aarch64__)
+#define MULTIARCH "aarch64-linux-gnu"
+#elif defined(__arm__)
+#define MULTIARCH "arm-linux-gnueabihf"
+#endif
+
+#if ELFCLASS == ELFCLASS64
+#define LIB64 ":/lib64:/usr/lib64"
+#else
+#define LIB64 ""
+#endif
+
+static const char default_dirs[] =
+    "/lib/" MULTIARCH ":/usr/lib/" MULTIARCH LIB64 ":/lib:/usr/lib:/usr/local/lib";
+
+static const char *base_name(const char *p)
+{
+    const char *b = p;
+    for (; *p; p++)
+        if (*p == '/')
+            b = p + 1;
+    return b;
+}
+
+static int has_slash(const char *p)
+{
+    for (; *p; p++)
+        if (*p == '/')
+            return 1;
+    return 0;
+}
+
+/* Cheap check that ld.so would accept the file for us. */
+static int usable(const char *path)
+{
+    Elf_Ehdr eh;
+    int fd, ok;
+
+    if ((fd = z_open(path, O_RDONLY)) < 0)
+        return 0;
+    ok = z_read(fd, &eh, sizeof(eh)) == sizeof(eh) &&
+         eh.e_ident[EI_MAG0] == ELFMAG0 && eh.e_ident[EI_MAG1] == ELFMAG1 &&
+         eh.e_ident[EI_MAG2] == ELFMAG2 && eh.e_ident[EI_MAG3] == ELFMAG3 &&
+         eh.e_ident[EI_CLASS] == ELFCLASS && eh.e_machine == Z_EM;
+    z_close(fd);
+    return ok;
+}
+
+/* out = dir + "/" + name, with a leading $ORIGIN/${ORIGIN} in dir
+ * replaced by origin. Returns 0 if it doesn't fit. */
+static int join(char *out, const char *dir, size_t dirlen,
+                const char *origin, const char *name)
+{
+    char *o = out, *e = out + FDL_PREFETCH_PATH_MAX - 1;
+    size_t skip = 0;
+
+    if (dirlen >= 7 && !z_memcmp(dir, "$ORIGIN", 7))
+        skip = 7;
+    else if (dirlen >= 9 && !z_memcmp(dir, "${ORIGIN}", 9))
+        skip = 9;
+    if (skip)
+    {
+        if (!origin)
+            return 0;
+        while (*origin && o < e)
+            *o++ = *origin++;
+        dir += skip;
+        dirlen -= skip;
+    }
+    while (dirlen-- && o < e)
+        *o++ = *dir++;
+    if (o < e)
+        *o++ = '/';
+    while (*name && o < e)
+        *o++ = *name++;
+    if (*name || o >= e)
+        return 0;
+    *o = 0;
+    return 1;
+}
+
+static int try_dirs(char *out, const char *dirs, const char *origin, const char *name)
+{
+    const char *p;
+
+    while (dirs && *dirs)
+    {
+        for (p = dirs; *p && *p != ':'; p++)
+            ;
+        if (p > dirs && join(out, dirs, p - dirs, origin, name) && usable(out))
+            return 1;
+        dirs = *p ? p + 1 : p;
+    }
+    return 0;
+}
+
+static int search(char *out, const char *name, const char *origin,
+                  const char *rpath, const char *runpath)
+{
+    const char *cached;
+
+    if (has_slash(name))
+    {
+        size_t i;
+        for (i = 0; name[i] && i < FDL_PREFETCH_PATH_MAX - 1; i++)
+            out[i] = name[i];
+        out[i] = 0;
+        return !name[i] && usable(out);
+    }
+    if (rpath && !runpath && try_dirs(out, rpath, origin, name))
+        return 1;
+    /* What the foreign ld.so searches, a profile may have changed it. */
+    if (try_dirs(out, fdl_getenv("LD_LIBRARY_PATH"), origin, name))
+        return 1;
+    if (runpath && try_dirs(out, runpath, origin, name))
+        return 1;
+    if ((cached = fdl_ldcache_lookup(name)) != NULL)
+    {
+        size_t i;
+        for (i = 0; cached[i] && i < FDL_PREFETCH_PATH_MAX - 1; i++)
+            out[i] = cached[i];
+        out[i] = 0;
+        if (!cached[i])
+            return 1;
+    }
+    return try_dirs(out, default_dirs, NULL, name);
+}
+
+static int seen(fdl_manifest_t *m, const char *name)
+{
+    for (int i = 0; i < m->count; i++)
+        if (!z_strcmp(base_name(m->path[i]), name) || !z_strcmp(m->path[i], name))
+            return 1;
+    return 0;
+}
+
+static unsigned long vaddr_to_off(Elf_Phdr *ph, int phnum, unsigned long va)
+{
+    for (int i = 0; i < phnum; i++)
+        if (ph[i].p_type == PT_LOAD && va >= ph[i].p_vaddr &&
+            va < ph[i].p_vaddr + ph[i].p_filesz)
+            return va - ph[i].p_vaddr + ph[i].p_offset;
+    return (unsigned long)-1;
+}
+
+/* Map m->path[idx], start its readahead and queue its dependencies. */
+static void scan(fdl_manifest_t *m, int idx)
+{
+    const char *path = m->path[idx], *strtab, *rpath = NULL, *runpath = NULL;
+    unsigned long size, stroff, strsz = 0, strva = 0;
+    unsigned long rpath_off = (unsigned long)-1, runpath_off = (unsigned long)-1;
+    char origin[FDL_PREFETCH_PATH_MAX];
+    Elf_Ehdr *eh;
+    Elf_Phdr *ph;
+    Elf_Dyn *dyn = NULL, *d, *dend = NULL;
+    unsigned char *map;
+    int fd, i;
+
+    if ((fd = z_open(path, O_RDONLY)) < 0)
+        return;
+    size = (unsigned long)z_lseek(fd, 0, SEEK_END);
+    map = z_mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    z_close(fd);
+    if (map == (void *)-1)
+        return;
+    z_madvise(map, size, MADV_WILLNEED);
+
+    eh = (Elf_Ehdr *)map;
+    if (size < sizeof(*eh) || eh->e_phoff + eh->e_phnum * sizeof(*ph) > size)
+        goto out;
+    ph = (Elf_Phdr *)(map + eh->e_phoff);
+    for (i = 0; i < eh->e_phnum; i++)
+    {
+        if (ph[i].p_type == PT_DYNAMIC && ph[i].p_offset + ph[i].p_filesz <= size)
+        {
+            dyn = (Elf_Dyn *)(map + ph[i].p_offset);
+            dend = (Elf_Dyn *)(map + ph[i].p_offset + ph[i].p_filesz);
+            break;
+        }
+    }
+    if (!dyn)
+        goto out;
+
+    for (d = dyn; d < dend && d->d_tag != DT_NULL; d++)
+    {
+        switch (d->d_tag)
+        {
+        case DT_STRTAB:
+            strva = d->d_un.d_ptr;
+            break;
+        case DT_STRSZ:
+            strsz = d->d_un.d_val;
+            break;
+        case DT_RPATH:
+            rpath_off = d->d_un.d_val;
+            break;
+        case DT_RUNPATH:
+            runpath_off = d->d_un.d_val;
+            break;
+        }
+    }
+    stroff = vaddr_to_off(ph, eh->e_phnum, strva);
+    if (stroff == (unsigned long)-1 || stroff + strsz > size)
+        goto out;
+    strtab = (const char *)map + stroff;
+    if (rpath_off < strsz)
+        rpath = strtab + rpath_off;
+    if (runpath_off < strsz)
+        runpath = strtab + runpath_off;
+
+    z_memcpy(origin, path, FDL_PREFETCH_PATH_MAX);
+    *(char *)base_name(origin) = 0;
+    for (i = 0; origin[i]; i++)
+        ;
+    if (i > 1)
+        origin[i - 1] = 0; /* drop the trailing '/' */
+
+    for (d = dyn; d < dend && d->d_tag != DT_NULL; d++)
+    {
+        const char *name;
+
+        if (d->d_tag != DT_NEEDED || d->d_un.d_val >= strsz)
+            continue;
+        name = strtab + d->d_un.d_val;
+        if (m->count == FDL_PREFETCH_MAX || seen(m, name))
+            continue;
+        if (search(m->path[m->count], name, origin, rpath, runpath) &&
+            !seen(m, m->path[m->count]))
+            m->count++;
+    }
+out:
+    z_munmap(map, size);
+}
+
+int fdl_prefetch(const char *path, fdl_manifest_t *m)
+{
+    fdl_manifest_t local;
+
+    if (!m)
+        m = &local;
+    m->count = 0;
+    if (!search(m->path[0], path, NULL, NULL, NULL))
+        return -1;
+    m->count = 1;
+    for (int i = 0; i < m->count; i++)
+        scan(m, i);
+    return m->count;
+}
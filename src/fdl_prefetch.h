@@ -0,0 +1,31 @@
+#ifndef FDL_PREFETCH_H
+#define FDL_PREFETCH_H
+
+/*
+ * Walk the DT_NEEDED closure of a shared object before handing it to the
+ * foreign dlopen, and ask the kernel to read every file of the closure
+ * ahead (MADV_WILLNEED on a private file mapping). ld.so's serial
+ * open/mmap chain then hits a warm page cache.
+ *
+ * The search follows ld.so: DT_RPATH (only without DT_RUNPATH),
+ * LD_LIBRARY_PATH, DT_RUNPATH, /etc/ld.so.cache, then the default
+ * directories. $ORIGIN is expanded, other dynamic string tokens are not.
+ * LD_LIBRARY_PATH is the one exec_elf() gave ld.so (fdl_getenv()), so a
+ * profile that changes it changes the search here as well.
+ */
+
+#define FDL_PREFETCH_MAX 128
+#define FDL_PREFETCH_PATH_MAX 256
+
+/* Breadth-first load order, path[0] is the object itself. */
+typedef struct
+{
+    int count;
+    char path[FDL_PREFETCH_MAX][FDL_PREFETCH_PATH_MAX];
+} fdl_manifest_t;
+
+/* Returns the number of files in the closure, -1 if path itself can't be
+ * found. m may be NULL when the manifest is not needed. */
+int fdl_prefetch(const char *path, fdl_manifest_t *m);
+
+#endif /* FDL_PREFETCH_H */
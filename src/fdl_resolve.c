@@ -1,6 +1,10 @@
 #include "fdl_resolve.h"
+#include "fdl_calls.h"
 #include "z_syscalls.h"
 #include "z_utils.h"
+#include "z_log.h"
+#include "z_once.h"
+#include "z_trace.h"
 #include "elf_loader.h"
 #include <stddef.h>
 
@@ -10,21 +14,51 @@
 
 static unsigned long text_base;
 static const char *soname;
+static char soname_buf[256];
+
+/* Resolved entry points. They are published once with release semantics,
+ * read them through fdl_dlopen_sym(NULL)/fdl_dlsym_sym(NULL). */
+void *fdl_dlopen;
+void *fdl_dlsym;
 
 void *fdl_dlopen_sym(void *p)
 {
-    static void *g_fdl_dlopen = NULL;
     if (p)
-        g_fdl_dlopen = p;
-    return g_fdl_dlopen;
+        __atomic_store_n(&fdl_dlopen, p, __ATOMIC_RELEASE);
+    return fdl_calls_wrap("dlopen", __atomic_load_n(&fdl_dlopen, __ATOMIC_ACQUIRE));
 }
 
 void *fdl_dlsym_sym(void *p)
 {
-    static void *g_fdl_dlsym = NULL;
     if (p)
-        g_fdl_dlsym = p;
-    return g_fdl_dlsym;
+        __atomic_store_n(&fdl_dlsym, p, __ATOMIC_RELEASE);
+    p = __atomic_load_n(&fdl_dlsym, __ATOMIC_ACQUIRE);
+#ifdef Z_CALLS
+    if (p)
+        p = (void *)fdl_calls_dlsym;
+#endif
+    return p;
+}
+
+static z_once_t g_default_once = Z_ONCE_INIT;
+static void *g_default_handle;
+
+static void open_default(void *arg)
+{
+    void *(*my_dlopen)(const char *, int) = arg;
+    g_default_handle = my_dlopen(NULL, RTLD_NOW);
+}
+
+/* dlsym() in the default (global) scope of the foreign runtime */
+void *fdl_default_sym(const char *name)
+{
+    void *(*my_dlopen)(const char *, int) = (void *(*)(const char *, int))fdl_dlopen_sym(NULL);
+    void *(*my_dlsym)(void *, const char *) = (void *(*)(void *, const char *))fdl_dlsym_sym(NULL);
+
+    if (!my_dlopen || !my_dlsym)
+        return NULL;
+    z_once(&g_default_once, open_default, (void *)my_dlopen);
+    return g_default_handle ? my_dlsym(g_default_handle, name) : NULL;
 }
 
 /* helper: turn a DT_* pointer/offset into an absolute VA */
@@ -108,6 +142,8 @@ static int parse_maps_line(const char *line,
     for (; (*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F'); p++)
         v = (v << 4) | (unsigned long)((*p <= '9') ? *p - '0' : (*p >= 'a' ? 10 + *p - 'a' : 10 + *p - 'A'));
     *offset = v;
+    while (*p == ' ')
+        p++;
 
     /* skip dev */
     while (*p && *p != ' ')
@@ -128,17 +164,6 @@ static int parse_maps_line(const char *line,
 /* Parse /proc/self/maps to find libc mapping with offset 0 */
 static int find_libc_base(void)
 {
-    static int cached = 0;
-    static unsigned long cached_base = 0;
-    static const char *cached_name = NULL;
-
-    if (cached)
-    {
-        text_base = cached_base;
-        soname = cached_name;
-        return 0;
-    }
-
     int fd = z_open(MAPS_PATH, O_RDONLY);
     if (fd < 0)
         return -1;
@@ -168,12 +193,14 @@ static int find_libc_base(void)
             if (parse_maps_line(line, &start, perms, &off, &path) == 0 &&
                 path && off == 0)
             {
+                /* path points into our stack buffer, keep a copy */
+                int i;
+                for (i = 0; path[i] && i < (int)sizeof(soname_buf) - 1; i++)
+                    soname_buf[i] = path[i];
+                soname_buf[i] = 0;
                 text_base = start;
-                soname = path;
-                z_fdprintf(2, "libc base 0x%lx @ %s\n", text_base, soname);
-                cached = 1;
-                cached_base = text_base;
-                cached_name = soname;
+                soname = soname_buf;
+                z_debug("libc base 0x%lx @ %s\n", text_base, soname);
                 *p = save;
                 return 0;
             }
@@ -186,28 +213,7 @@ static int find_libc_base(void)
     return -1;
 }
 
-/* In-memory ELF helpers */
-typedef struct
-{
-    Elf_Ehdr *eh;
-    Elf_Phdr *ph;
-    Elf_Dyn *dyn;
-    unsigned long base;
-    unsigned long nbucket, nchain;
-    uint32_t *buckets, *chains;
-    uint32_t *gnu_buckets;
-    uint32_t *gnu_chain;
-    uint32_t gnu_maskwords;
-    uint32_t gnu_shift2;
-    unsigned long *gnu_bloom;
-    uint32_t gnu_nbucket;
-    uint32_t gnu_symoffset;
-    Elf_Sym *dynsym;
-    const char *dynstr;
-    uint16_t *versym;
-} mod_t;
-
-static int mod_init(mod_t *m, unsigned long base)
+int fdl_mod_init(fdl_mod_t *m, unsigned long base)
 {
     m->base = base;
     m->eh = (Elf_Ehdr *)base;
@@ -216,9 +222,9 @@ static int mod_init(mod_t *m, unsigned long base)
         return -1;
 
     m->ph = (Elf_Phdr *)(base + m->eh->e_phoff);
-    z_fdprintf(2, "mod_init: base=0x%lx phoff=0x%lx phnum=%u entsz=%u\n",
-               base, (unsigned long)m->eh->e_phoff,
-               (unsigned)m->eh->e_phnum, (unsigned)m->eh->e_phentsize);
+    z_debug("fdl_mod_init: base=0x%lx phoff=0x%lx phnum=%u entsz=%u\n",
+            base, (unsigned long)m->eh->e_phoff,
+            (unsigned)m->eh->e_phnum, (unsigned)m->eh->e_phentsize);
 
     unsigned long lo = ~0UL, hi = 0;
     for (int i = 0; i < m->eh->e_phnum; i++)
@@ -243,18 +249,18 @@ static int mod_init(mod_t *m, unsigned long base)
             unsigned long dyn_addr = base + m->ph[i].p_vaddr;
             if (dyn_addr < lo || dyn_addr + sizeof(Elf_Dyn) > hi)
             {
-                z_fdprintf(2, "mod_init: PT_DYNAMIC out of range: 0x%lx [0x%lx..0x%lx)\n",
-                           dyn_addr, lo, hi);
+                z_warn("fdl_mod_init: PT_DYNAMIC out of range: 0x%lx [0x%lx..0x%lx)\n",
+                       dyn_addr, lo, hi);
                 return -1;
             }
             m->dyn = (Elf_Dyn *)dyn_addr;
-            z_fdprintf(2, "mod_init: PT_DYNAMIC @ 0x%lx\n", dyn_addr);
+            z_debug("fdl_mod_init: PT_DYNAMIC @ 0x%lx\n", dyn_addr);
             break;
         }
     }
     if (!m->dyn)
     {
-        z_fdprintf(2, "mod_init: no PT_DYNAMIC\n");
+        z_warn("fdl_mod_init: no PT_DYNAMIC\n");
         return -1;
     }
 
@@ -296,7 +302,7 @@ static int mod_init(mod_t *m, unsigned long base)
             break;
         }
     }
-    z_fdprintf(2, "mod_init: dynsym=%p dynstr=%p gnu_hash=%p sysv_hash=%p\n", m->dynsym, m->dynstr, m->gnu_buckets, m->buckets);
+    z_debug("fdl_mod_init: dynsym=%p dynstr=%p gnu_hash=%p sysv_hash=%p\n", m->dynsym, m->dynstr, m->gnu_buckets, m->buckets);
 
     return (m->dynsym && m->dynstr) ? 0 : -1;
 }
@@ -323,8 +329,16 @@ static uint32_t gnu_hash_str(const char *s)
     return h;
 }
 
+/* Non-default version (foo@V, not foo@@V) of a versioned symbol. Those
+ * only win when there is nothing else, as with an unversioned ld.so
+ * lookup: e.g. memcpy@GLIBC_2.2.5 is memmove. */
+static inline int is_hidden(fdl_mod_t *m, uint32_t idx)
+{
+    return m->versym && (m->versym[idx] & 0x8000);
+}
+
 /* GNU hash lookup */
-static Elf_Sym *lookup_gnu(mod_t *m, const char *name)
+Elf_Sym *fdl_lookup_gnu(fdl_mod_t *m, const char *name)
 {
     if (!m->gnu_buckets)
         return NULL;
@@ -336,6 +350,7 @@ static Elf_Sym *lookup_gnu(mod_t *m, const char *name)
         return NULL;
 
     uint32_t idx = m->gnu_buckets[u32_mod(h, m->gnu_nbucket)];
+    Elf_Sym *hidden = NULL;
     if (!idx)
         return NULL;
     for (;;)
@@ -345,31 +360,44 @@ static Elf_Sym *lookup_gnu(mod_t *m, const char *name)
         {
             Elf_Sym *sym = &m->dynsym[idx];
             if (sym->st_name && !z_strcmp(m->dynstr + sym->st_name, name))
-                return sym;
+            {
+                if (!is_hidden(m, idx))
+                    return sym;
+                if (!hidden)
+                    hidden = sym;
+            }
         }
         if (hv & 1U)
             break;
         idx++;
     }
-    return NULL;
+    return hidden;
 }
 
 /* SysV hash lookup */
-static Elf_Sym *lookup_sysv(mod_t *m, const char *name)
+Elf_Sym *fdl_lookup_sysv(fdl_mod_t *m, const char *name)
 {
     if (!m->buckets)
         return NULL;
     uint32_t h = sysv_hash(name);
+    Elf_Sym *hidden = NULL;
     for (uint32_t i = m->buckets[u32_mod(h, m->nbucket)]; i != 0; i = m->chains[i])
     {
         Elf_Sym *sym = &m->dynsym[i];
-        if (sym->st_name && !z_strcmp(m->dynstr + sym->st_name, name))
-            return sym;
+        /* Unlike the GNU table, this one also hashes the imports. */
+        if (sym->st_name && sym->st_shndx != SHN_UNDEF &&
+            !z_strcmp(m->dynstr + sym->st_name, name))
+        {
+            if (!is_hidden(m, i))
+                return sym;
+            if (!hidden)
+                hidden = sym;
+        }
     }
-    return NULL;
+    return hidden;
 }
 
-static void *resolve_sym(mod_t *m, const char *name)
+void *fdl_resolve_sym(fdl_mod_t *m, const char *name)
 {
     Elf_Sym *s = NULL;
     //z_printf("resolve_sym: %s\n", name);
@@ -377,12 +405,12 @@ static void *resolve_sym(mod_t *m, const char *name)
     if (!s)
     {
         //z_printf("lookup_gnu\n");
-        s = lookup_gnu(m, name);
+        s = fdl_lookup_gnu(m, name);
     }
     if (!s)
     {
         //z_printf("lookup_sysv\n");
-        s = lookup_sysv(m, name);
+        s = fdl_lookup_sysv(m, name);
     }
     if (!s)
     {
@@ -396,34 +424,79 @@ static void *resolve_sym(mod_t *m, const char *name)
     return (void *)(m->base + s->st_value);
 }
 
-int fdl_resolve_from_maps(unsigned long interp_base)
+static z_once_t g_resolve_once = Z_ONCE_INIT;
+static int g_resolve_rc = -1;
+static fdl_mod_t g_libc;
+static int g_libc_ok;
+/* Set by exec_elf() before ld.so runs. */
+static int g_interp_libc;
+
+/* musl's ld.so is its libc and has the libc entry point, glibc's leaves
+ * that to libc.so.6. The image is not relocated yet, dyn_ptr() copes. */
+int fdl_interp_is_libc(const char *path, unsigned long base)
+{
+    fdl_mod_t m;
+
+    z_memset(&m, 0, sizeof(m));
+    g_interp_libc = z_strstr(path, "/ld-musl-") != NULL ||
+                    (fdl_mod_init(&m, base) == 0 && fdl_resolve_sym(&m, "__libc_start_main"));
+    z_debug("interp %s is %sthe libc\n", path, g_interp_libc ? "" : "not ");
+    return g_interp_libc;
+}
+
+/* Runs once, whatever it writes is published by z_once(). */
+static void resolve_once(void *arg)
 {
-    if (find_libc_base() < 0)
+    unsigned long interp_base = *(unsigned long *)arg;
+    int libc_interp = g_interp_libc && interp_base;
+    int rc = libc_interp ? -1 : find_libc_base();
+
+    z_trace("find_libc_base", rc);
+    if (rc < 0)
     {
         if (interp_base)
         {
-            z_printf("Falling back to the interpreter, for muslc the loader/libc are the same \n");
+            if (!libc_interp)
+                z_info("Falling back to the interpreter, for muslc the loader/libc are the same \n");
             text_base = interp_base;
         }
         else
         {
-            return -1;
+            return;
         }
     }
 
-    mod_t M;
-    z_memset(&M, 0, sizeof(M));
-    if (mod_init(&M, text_base) < 0)
-        return -1;
-        
+    fdl_mod_t *M = &g_libc;
+    rc = fdl_mod_init(M, text_base);
+    z_trace("mod_init", rc);
+    if (rc < 0)
+        return;
+    g_libc_ok = 1;
+
     /* glibc: prefer __libc_dlopen_mode; fallback to dlopen/dlsym */
-    void *dlopen = resolve_sym(&M, "__libc_dlopen_mode");
+    void *dlopen = libc_interp ? NULL : fdl_resolve_sym(M, "__libc_dlopen_mode");
     if (!dlopen)
-        dlopen = resolve_sym(&M, "dlopen");
+        dlopen = fdl_resolve_sym(M, "dlopen");
 
-    void *dlsym = resolve_sym(&M, "dlsym");
+    void *dlsym = fdl_resolve_sym(M, "dlsym");
 
+    z_trace("resolve", !!dlopen + !!dlsym);
     fdl_dlopen_sym(dlopen);
     fdl_dlsym_sym(dlsym);
-    return (dlopen && dlsym) ? 0 : -1;
+    g_resolve_rc = (dlopen && dlsym) ? 0 : -1;
+}
+
+int fdl_resolve_from_maps(unsigned long interp_base)
+{
+    z_once(&g_resolve_once, resolve_once, &interp_base);
+    return g_resolve_rc;
+}
+
+/* Doesn't resolve on its own: before the foreign runtime is up there is
+ * no libc to find, and the once would stick to that. */
+fdl_mod_t *fdl_libc_mod(void)
+{
+    if (__atomic_load_n(&g_resolve_once, __ATOMIC_ACQUIRE) != Z_ONCE_DONE)
+        return NULL;
+    return g_libc_ok ? &g_libc : NULL;
 }
@@ -4,11 +4,54 @@
 #include "z_elf.h"
 #include <stdint.h>
 
+#ifndef RTLD_NOW
+#define RTLD_NOW 0x0002
+#endif
+
+/* Published once by fdl_resolve_from_maps(), read them with an acquire
+ * load, i.e. through fdl_dlopen_sym(NULL)/fdl_dlsym_sym(NULL). */
 extern void *fdl_dlopen;
 extern void *fdl_dlsym;
 
+/* Safe to call from several threads, only the first one does the work. */
 int fdl_resolve_from_maps(unsigned long interp_base);
+/* From exec_elf() once ld.so is mapped. When it is the libc as well
+ * (musl), fdl_resolve_from_maps() takes it without reading the maps. */
+int fdl_interp_is_libc(const char *path, unsigned long base);
 void *fdl_dlopen_sym(void *p);
 void *fdl_dlsym_sym(void *p);
+void *fdl_default_sym(const char *name);
+
+/* Dynamic symbol tables of an ELF object mapped at base as ld.so would,
+ * filled in by fdl_mod_init() from its PT_DYNAMIC. Zero it first. */
+typedef struct
+{
+    Elf_Ehdr *eh;
+    Elf_Phdr *ph;
+    Elf_Dyn *dyn;
+    unsigned long base;
+    unsigned long nbucket, nchain;
+    uint32_t *buckets, *chains;
+    uint32_t *gnu_buckets;
+    uint32_t *gnu_chain;
+    uint32_t gnu_maskwords;
+    uint32_t gnu_shift2;
+    unsigned long *gnu_bloom;
+    uint32_t gnu_nbucket;
+    uint32_t gnu_symoffset;
+    Elf_Sym *dynsym;
+    const char *dynstr;
+    uint16_t *versym;
+} fdl_mod_t;
+
+int fdl_mod_init(fdl_mod_t *m, unsigned long base);
+/* Defined symbols only, the default version if there is one. NULL if the
+ * object has no such table. */
+Elf_Sym *fdl_lookup_gnu(fdl_mod_t *m, const char *name);
+Elf_Sym *fdl_lookup_sysv(fdl_mod_t *m, const char *name);
+/* Address of a function, GNU table first. */
+void *fdl_resolve_sym(fdl_mod_t *m, const char *name);
+/* The foreign libc, once fdl_resolve_from_maps() found it, else NULL. */
+fdl_mod_t *fdl_libc_mod(void);
 
 #endif /* FDL_RESOLVE_H */
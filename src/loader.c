@@ -1,9 +1,15 @@
 #include "z_asm.h"
 #include "z_syscalls.h"
 #include "z_utils.h"
+#include "z_log.h"
+#include "z_trace.h"
+#include "z_perfmap.h"
+#include "z_prof.h"
+#include "z_memstat.h"
 #include "z_elf.h"
 #include "elf_loader.h"
 #include "fdl_resolve.h"
+#include "fdl_calls.h"
 
 #define PAGE_SIZE 4096
 #define ALIGN (PAGE_SIZE - 1)
@@ -19,25 +25,43 @@ unsigned long *entry_sp;
 
 /* External fini function that the caller can provide us. */
 static void (*x_fini)(void);
+/* Foreign-side main the caller can provide us, see fdl_set_main(). */
+static void (*x_fdl_main)(void);
+/* Env changes for the foreign side, see fdl_set_profile(). */
+static const char *x_profile;
+/* The env the foreign side got, see fdl_getenv(). */
+static char **x_env;
 static unsigned long g_interp_base = 0;
 
 static void z_fini(void)
 {
-	z_printf("Fini at work: x_fini %p\n", x_fini);
+	z_debug("Fini at work: x_fini %p\n", x_fini);
 	if (x_fini != NULL)
 		x_fini();
+	z_log_flush();
+	fdl_calls_dump(2);
+	z_prof_dump(2);
+	z_stats_dump(2);
 }
 
 // MUST ensure that stack is 16 byte aligned for calls to external functions
 // especially ones with variadic arguments. We do this via the z_fdlentry.S wrapper
 void fdl_entry_impl(void)
 {
-	z_printf("Loader is in memory... Start parsing logic\n");
+	/* Since "trampo": ld.so and libc init. */
+	z_trace("fdl_entry", 0);
+	z_debug("Loader is in memory... Start parsing logic\n");
 	if (fdl_resolve_from_maps(g_interp_base) == 0)
 	{
-#ifndef RTLD_NOW
-#define RTLD_NOW 0x0002
-#endif
+		z_log_flush();
+		z_memstat_dump();
+		if (x_fdl_main != NULL)
+		{
+			z_trace_dump();
+			x_fdl_main();
+			fdl_calls_dump(2);
+			z_exit(0);
+		}
 		void *(*my_dlopen)(const char *, int) = (void *(*)(const char *, int))fdl_dlopen_sym(NULL);
 		void *(*my_dlsym)(void *, const char *) = (void *(*)(void *, const char *))fdl_dlsym_sym(NULL);
 		int (*libc_printf)(const char *, ...) = 0;
@@ -45,6 +69,8 @@ void fdl_entry_impl(void)
 		z_printf("fdl: dlopen=%p dlsym=%p\n", my_dlopen, my_dlsym);
 
 		void *h = my_dlopen(NULL, RTLD_NOW);
+		z_trace("dlopen", 0);
+		z_trace_dump();
 		z_printf("handle: %p\n", h);
 
 		libc_printf = (int (*)(const char *, ...))my_dlsym(h, "printf");
@@ -54,9 +80,212 @@ void fdl_entry_impl(void)
 			libc_printf("[libc printf] hello via foreign dlopen\n");
 		z_printf("Done\n");
 	}
+	fdl_calls_dump(2);
+	z_log_flush();
+	z_trace_dump();
 	z_exit(0);
 }
 
+void fdl_set_main(void (*fn)(void))
+{
+	x_fdl_main = fn;
+}
+
+char *fdl_getenv(const char *name)
+{
+	return x_env ? z_getenv_from(x_env, name) : z_getenv(name);
+}
+
+void fdl_set_profile(const char *profile)
+{
+	x_profile = profile;
+}
+
+#define PROFILE_MAX 32
+
+typedef struct
+{
+	char op; /* '=' set, '+' append, '-' unset */
+	const char *name, *val;
+	size_t nlen, vlen;
+} env_op_t;
+
+static char g_profile_file[4096];
+/* The "NAME=value" strings the changed foreign env points to. */
+static char g_env_strs[8192];
+static size_t g_env_used;
+
+/* Appends the changes in s to ops, in order. */
+static int profile_parse(const char *s, env_op_t *ops, int n)
+{
+	while (s && *s)
+	{
+		const char *line = s, *end, *eq;
+		env_op_t op;
+
+		while (*s && *s != '\n')
+			s++;
+		end = s;
+		if (*s)
+			s++;
+		while (line < end && (*line == ' ' || *line == '\t'))
+			line++;
+		if (end > line && end[-1] == '\r')
+			end--;
+		if (line == end || *line == '#')
+			continue;
+		op.op = '=';
+		op.val = NULL;
+		op.vlen = 0;
+		if (*line == '-')
+		{
+			op.op = '-';
+			op.name = ++line;
+			op.nlen = end - line;
+		}
+		else
+		{
+			for (eq = line; eq < end && *eq != '='; eq++)
+				;
+			if (eq == end)
+			{
+				z_warn("profile: no '=' in a line, skipped\n");
+				continue;
+			}
+			op.name = line;
+			op.nlen = eq - line;
+			if (op.nlen && line[op.nlen - 1] == '+')
+			{
+				op.op = '+';
+				op.nlen--;
+			}
+			op.val = eq + 1;
+			op.vlen = end - op.val;
+		}
+		if (op.nlen == 0)
+			continue;
+		if (n == PROFILE_MAX)
+		{
+			z_warn("profile: more than %d changes, the rest is ignored\n", PROFILE_MAX);
+			break;
+		}
+		ops[n++] = op;
+	}
+	return n;
+}
+
+/* The compiled in profile, then the file FDL_PROFILE names. */
+static int profile_load(env_op_t *ops)
+{
+	const char *path = z_getenv("FDL_PROFILE");
+	int n = profile_parse(x_profile, ops, 0), fd;
+	size_t len = 0;
+	ssize_t r;
+	char c;
+
+	if (path && *path)
+	{
+		if ((fd = z_open(path, O_RDONLY)) < 0)
+			z_warn("profile: can't open %s\n", path);
+		else
+		{
+			while (len < sizeof(g_profile_file) - 1 &&
+				   (r = z_read(fd, g_profile_file + len, sizeof(g_profile_file) - 1 - len)) > 0)
+				len += r;
+			if (len == sizeof(g_profile_file) - 1 && z_read(fd, &c, 1) > 0)
+				z_warn("profile: %s is over %lu bytes, the rest is ignored\n", path,
+					   (unsigned long)len);
+			z_close(fd);
+			g_profile_file[len] = 0;
+			n = profile_parse(g_profile_file, ops, n);
+		}
+	}
+	if (n)
+		z_info("profile: %d env changes\n", n);
+	return n;
+}
+
+/* "NAME=value" once every change to name is applied to old (NULL if name
+ * is not set). old itself if no change is about name, NULL if it ends up
+ * unset. */
+static char *profile_apply(const env_op_t *ops, int n, const char *name,
+						   size_t nlen, char *old)
+{
+	char *out = g_env_strs + g_env_used, *end = g_env_strs + sizeof(g_env_strs) - 1;
+	char *val = out + nlen + 1, *p = val;
+	int first, touched = 0, set = old != NULL;
+
+	/* Most of the env is left alone, don't copy it. */
+	for (first = 0; first < n; first++)
+		if (ops[first].nlen == nlen && !z_memcmp(ops[first].name, name, nlen))
+			break;
+	if (first == n)
+		return old;
+	if (end - out < (long)nlen + 1)
+	{
+		z_warn("profile: no room left for %.*s\n", (int)nlen, name);
+		return old;
+	}
+	z_memcpy(out, name, nlen);
+	out[nlen] = '=';
+	/* Only an append keeps the old value. */
+	if (old && ops[first].op == '+')
+		for (const char *v = old + nlen + 1; *v && p < end; v++)
+			*p++ = *v;
+	for (int i = first; i < n; i++)
+	{
+		if (ops[i].nlen != nlen || z_memcmp(ops[i].name, name, nlen))
+			continue;
+		touched = 1;
+		if (ops[i].op != '+')
+			p = val;
+		if (ops[i].op == '+' && set && p > val && p < end)
+			*p++ = ':';
+		set = ops[i].op != '-';
+		for (size_t k = 0; k < ops[i].vlen && p < end; k++)
+			*p++ = ops[i].val[k];
+	}
+	if (p == end)
+	{
+		z_warn("profile: no room left for %.*s\n", (int)nlen, name);
+		return old;
+	}
+	if (!touched || !set)
+		return touched ? NULL : old;
+	*p++ = 0;
+	g_env_used = p - g_env_strs;
+	z_debug("profile: %s\n", out);
+	return out;
+}
+
+/* Writes the changed env to dst, returns where it stopped. */
+static char **profile_env(char **dst, char **env, const env_op_t *ops, int n)
+{
+	char **e, *s;
+	size_t nlen;
+
+	for (e = env; *e; e++)
+	{
+		for (nlen = 0; (*e)[nlen] && (*e)[nlen] != '='; nlen++)
+			;
+		if ((s = profile_apply(ops, n, *e, nlen, *e)) != NULL)
+			*dst++ = s;
+	}
+	/* Names the env doesn't have yet, once each. */
+	for (int i = 0; i < n; i++)
+	{
+		int seen = 0;
+
+		for (int j = 0; j < i && !seen; j++)
+			seen = ops[j].nlen == ops[i].nlen && !z_memcmp(ops[j].name, ops[i].name, ops[i].nlen);
+		for (e = env; *e && !seen; e++)
+			seen = !z_memcmp(*e, ops[i].name, ops[i].nlen) && (*e)[ops[i].nlen] == '=';
+		if (!seen && (s = profile_apply(ops, n, ops[i].name, ops[i].nlen, NULL)) != NULL)
+			*dst++ = s;
+	}
+	return dst;
+}
+
 static int check_ehdr(Elf_Ehdr *ehdr)
 {
 	unsigned char *e_ident = ehdr->e_ident;
@@ -69,12 +298,13 @@ static int check_ehdr(Elf_Ehdr *ehdr)
 			   : 1;
 }
 
-static unsigned long loadelf_anon(int fd, Elf_Ehdr *ehdr, Elf_Phdr *phdr)
+unsigned long loadelf_anon(int fd, Elf_Ehdr *ehdr, Elf_Phdr *phdr)
 {
 	unsigned long minva, maxva;
 	Elf_Phdr *iter;
 	ssize_t sz;
 	int flags, dyn = ehdr->e_type == ET_DYN;
+	int file_backed = z_perfmap_enabled();
 	unsigned char *p, *base, *hint;
 
 	minva = (unsigned long)-1;
@@ -116,19 +346,38 @@ static unsigned long loadelf_anon(int fd, Elf_Ehdr *ehdr, Elf_Phdr *phdr)
 		start += TRUNC_PG(iter->p_vaddr);
 		sz = ROUND_PG(iter->p_memsz + off);
 
-		p = z_mmap((void *)start, sz, PROT_READ | PROT_WRITE, flags, -1, 0);
-		if (p == (void *)-1)
+		if (file_backed && iter->p_filesz && (iter->p_offset & ALIGN) == off)
 		{
-			goto err;
+			/* Profilers see the file, the kernel way: bss zeroed in
+			 * the last file page and anonymous past it. */
+			unsigned long fsz = ROUND_PG(iter->p_filesz + off);
+
+			p = z_mmap((void *)start, fsz, PROT_READ | PROT_WRITE,
+					   MAP_FIXED | MAP_PRIVATE, fd, TRUNC_PG(iter->p_offset));
+			if (p == (void *)-1)
+				goto err;
+			if (iter->p_memsz > iter->p_filesz)
+				z_memset(p + off + iter->p_filesz, 0, fsz - off - iter->p_filesz);
+			if ((unsigned long)sz > fsz &&
+				z_mmap(p + fsz, sz - fsz, PROT_READ | PROT_WRITE, flags, -1, 0) == (void *)-1)
+				goto err;
 		}
-		if (z_lseek(fd, iter->p_offset, SEEK_SET) < 0)
+		else
 		{
-			goto err;
-		}
-		if (z_read(fd, p + off, iter->p_filesz) !=
-			(ssize_t)iter->p_filesz)
-		{
-			goto err;
+			p = z_mmap((void *)start, sz, PROT_READ | PROT_WRITE, flags, -1, 0);
+			if (p == (void *)-1)
+			{
+				goto err;
+			}
+			if (z_lseek(fd, iter->p_offset, SEEK_SET) < 0)
+			{
+				goto err;
+			}
+			if (z_read(fd, p + off, iter->p_filesz) !=
+				(ssize_t)iter->p_filesz)
+			{
+				goto err;
+			}
 		}
 		z_mprotect(p, sz, PFLAGS(iter->p_flags));
 	}
@@ -153,6 +402,10 @@ void z_entry(unsigned long *sp, void (*fini)(void))
 	x_fini = fini;
 	argc = (int)*(sp);
 	argv = (char **)(sp + 1);
+	z_environ = argv + argc + 1;
+	z_cpu_init();
+	z_log_init();
+	z_prof_init();
 	main(argc, argv);
 }
 
@@ -162,6 +415,10 @@ void init_exec_elf(char *argv[])
 	if (entry_sp == NULL)
 	{
 		entry_sp = (unsigned long *)argv - 1;
+		z_environ = argv + *entry_sp + 1;
+		z_cpu_init();
+		z_log_init();
+		z_prof_init();
 	}
 }
 
@@ -173,9 +430,12 @@ void exec_elf(const char *file, int argc, char *argv[])
 	char **env, **p, *elf_interp = NULL;
 	unsigned long *sp = entry_sp;
 	unsigned long base[2], entry[2];
+	env_op_t ops[PROFILE_MAX];
+	int nops = profile_load(ops);
 	ssize_t sz;
 	int fd, i;
 
+	z_trace("exec", 0);
 	{
 		unsigned long *p = sp;
 		/* argc */
@@ -185,23 +445,64 @@ void exec_elf(const char *file, int argc, char *argv[])
 			;
 
 		unsigned long *from = p;
-		/* env */
-		while (*p++ != 0)
-			;
-		/* aux vector */
-		while (*p++ != 0)
+		/* New argc, argv and its NULL right before the env block. */
+		unsigned long *to = from - (argc + 2);
+		unsigned long argv_sz = argc * sizeof(*p);
+		/* Words to move down by to keep sp 16 byte aligned. */
+		unsigned long shift = ((unsigned long)to & 15) / sizeof(*p);
+		int in_place = !nops && to - shift >= sp;
+
+		if (in_place)
 		{
-			p++;
+			/* It fits over the old argv: leave env and auxv where they
+			 * are, or slide them down a little when sp would end up
+			 * misaligned. argv may point into the old one. */
+			char **tmp = z_alloca(argv_sz);
+			z_memcpy(tmp, argv, argv_sz);
+			if (shift)
+			{
+				unsigned long *d = from - shift;
+
+				/* env */
+				while (*p++ != 0)
+					;
+				/* aux vector */
+				while (*p++ != 0)
+					p++;
+				p++;
+				/* Forward, the ranges overlap. */
+				for (unsigned long *s = from; s < p;)
+					*d++ = *s++;
+				to -= shift;
+				z_environ = (char **)(from - shift);
+			}
+			z_memcpy(to + 1, tmp, argv_sz);
 		}
-		p++;
+		else
+		{
+			/* env */
+			while (*p++ != 0)
+				;
+			unsigned long *aux = p;
+			/* aux vector */
+			while (*p++ != 0)
+			{
+				p++;
+			}
+			p++;
 
-		unsigned long argv_sz = argc * sizeof(*p);
-		unsigned sz = (char *)p - (char *)from;
-		p = alloca(sizeof(*p) + argv_sz + sz);
-		*p = argc;
-		z_memcpy(p + 1, argv, argv_sz);
-		z_memcpy((char *)(p + 1) + argv_sz, from, sz);
-		sp = p;
+			/* The profile adds nops entries at most. */
+			unsigned long sz = (char *)p - (char *)aux;
+			to = z_alloca((argc + 2 + (aux - from) + nops) * sizeof(*p) + sz);
+			z_memcpy(to + 1, argv, argv_sz);
+			char **e = profile_env((char **)(to + argc + 2), (char **)from, ops, nops);
+			*e++ = NULL;
+			z_memcpy(e, aux, sz);
+		}
+		to[0] = argc;
+		to[argc + 1] = 0;
+		z_debug("exec_elf: argv %s\n", in_place ? "in place" : "copied");
+		sp = to;
 		argv = (char **)sp + 1;
 	}
 
@@ -209,8 +510,7 @@ void exec_elf(const char *file, int argc, char *argv[])
 	while (*p++ != NULL)
 		;
 	av = (void *)p;
-
-	(void)env;
+	x_env = env;
 
 	for (i = 0;; i++, ehdr++)
 	{
@@ -229,9 +529,14 @@ void exec_elf(const char *file, int argc, char *argv[])
 			z_errx(1, "can't lseek to program header %s", file);
 		if (z_read(fd, phdr, sz) != sz)
 			z_errx(1, "can't read program header %s", file);
+		z_trace("ehdr", i);
 		/* Time to load ELF. */
 		if ((base[i] = loadelf_anon(fd, ehdr, phdr)) == LOAD_ERR)
 			z_errx(1, "can't load ELF %s", file);
+		z_perfmap_image(file, fd, ehdr, phdr, base[i]);
+		z_prof_image(file, ehdr, phdr, base[i]);
+		z_memstat_image(i == Z_INTERP ? "interp" : "host", ehdr, phdr, base[i]);
+		z_trace("loadelf", i);
 
 		/* Set the entry point, if the file is dynamic than add bias. */
 		entry[i] = ehdr->e_entry + (ehdr->e_type == ET_DYN ? base[i] : 0);
@@ -250,7 +555,7 @@ void exec_elf(const char *file, int argc, char *argv[])
 				z_errx(1, "can't read interp segment");
 			if (elf_interp[iter->p_filesz - 1] != '\0')
 				z_errx(1, "bogus interp path");
-			z_printf("elf_interp: %s\n", elf_interp);
+			z_debug("elf_interp: %s\n", elf_interp);
 			file = elf_interp;
 		}
 		/* Looks like the ELF is static -- leave the loop. */
@@ -281,14 +586,18 @@ void exec_elf(const char *file, int argc, char *argv[])
 	}
 #undef AVSET
 	++av;
+	z_trace("auxv", 0);
 
 	if (elf_interp)
 	{
 		g_interp_base = base[Z_INTERP];
+		fdl_interp_is_libc(elf_interp, g_interp_base);
 	}
 	// z_printf("base: 0x%lx\n", interp_base);
 
-	z_printf("Calling trampo...file: %s, interp: %s\n", file ? file : "(null)", elf_interp ? elf_interp : "(null)");
+	z_debug("Calling trampo...file: %s, interp: %s\n", file ? file : "(null)", elf_interp ? elf_interp : "(null)");
+	z_log_flush();
+	z_trace("trampo", 0);
 	z_trampo((void (*)(void))(elf_interp ? entry[Z_INTERP] : entry[Z_PROG]), sp, z_fini);
 	/* Should not reach. */
 	z_exit(0);
@@ -8,5 +8,12 @@ PRIVATE void z_start(void);
 PRIVATE void z_trampo(void (*entry)(void), unsigned long *sp, void (*fini)(void));
 PRIVATE long z_syscall(int n, ...);
 PRIVATE void z_fdl_entry(void);
+PRIVATE void z_sigreturn(void);
+/* Bounds of the per-arch callback stub z_thunk.c copies, not callable. */
+PRIVATE void z_thunk_tmpl(void);
+PRIVATE void z_thunk_tmpl_end(void);
+/* fdl_calls.c entry stubs, and where they make the target return to. */
+PRIVATE void z_calls_stubs(void);
+PRIVATE void z_calls_exit(void);
 #endif /* Z_ASM_H */
 
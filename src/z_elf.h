@@ -6,22 +6,55 @@
 #if ELFCLASS == ELFCLASS64
 #  define Elf_Ehdr	Elf64_Ehdr
 #  define Elf_Phdr	Elf64_Phdr
+#  define Elf_Shdr	Elf64_Shdr
 #  define Elf_Sym   Elf64_Sym
 #  define Elf_Dyn   Elf64_Dyn
 #  define Elf_auxv_t	Elf64_auxv_t
+#  define Elf_Addr  Elf64_Addr
+#  define Elf_Rel   Elf64_Rel
+#  define Elf_Rela  Elf64_Rela
+#  define ELF_R_SYM(i)  ELF64_R_SYM(i)
+#  define ELF_R_TYPE(i) ELF64_R_TYPE(i)
 #elif ELFCLASS == ELFCLASS32
 #  define Elf_Ehdr	Elf32_Ehdr
 #  define Elf_Phdr	Elf32_Phdr
+#  define Elf_Shdr	Elf32_Shdr
 #  define Elf_Sym   Elf32_Sym
 #  define Elf_Dyn   Elf32_Dyn
 #  define Elf_auxv_t	Elf32_auxv_t
+#  define Elf_Addr  Elf32_Addr
+#  define Elf_Rel   Elf32_Rel
+#  define Elf_Rela  Elf32_Rela
+#  define ELF_R_SYM(i)  ELF32_R_SYM(i)
+#  define ELF_R_TYPE(i) ELF32_R_TYPE(i)
 #else
 #  error "ELFCLASS is not defined"
 #endif
 
+/* e_machine of the objects we can load next to ourselves */
+#if defined(__x86_64__)
+#  define Z_EM EM_X86_64
+#elif defined(__i386__)
+#  define Z_EM EM_386
+#elif defined(__aarch64__)
+#  define Z_EM EM_AARCH64
+#elif defined(__arm__)
+#  define Z_EM EM_ARM
+#endif
+
 #ifndef ELF_ST_TYPE
 #define ELF_ST_TYPE(i) ((i) & 0xF)
 #endif
+#ifndef ELF_ST_BIND
+#define ELF_ST_BIND(i) ((i) >> 4)
+#endif
+
+/* Older <elf.h> predate packed relative relocations. */
+#ifndef DT_RELR
+#define DT_RELRSZ 35
+#define DT_RELR 36
+#define DT_RELRENT 37
+#endif
 
 #endif /* Z_ELF_H */
 
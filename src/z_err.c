@@ -1,14 +1,17 @@
+#include "z_log.h"
 #include "z_syscalls.h"
 #include "z_utils.h"
 
 void z_errx(int eval, const char *fmt, ...)
 {
+	char msg[200];
 	va_list ap;
-	z_fdprintf(2, "error: ");
+
 	va_start(ap, fmt);
-	z_vfdprintf(2, fmt, ap);
+	z_vsnprintf(msg, sizeof(msg), fmt, ap);
 	va_end(ap);
-	z_fdprintf(2, "\n");
+	/* Goes out together with whatever the log still holds. */
+	z_log_emit(Z_LOG_ERR, "error: %s\n", msg);
 	z_exit(eval);
 }
 
@@ -0,0 +1,95 @@
+#include "z_log.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+
+#define LOG_FD 2
+#define LOG_BUF 4096
+#define LOG_LINE 256
+
+int z_log_level = Z_LOG_ERR;
+
+/* Records from any thread, appended and written out under g_lock. */
+static char g_buf[LOG_BUF];
+static size_t g_len;
+static uint32_t g_lock;
+
+static const char *const g_names[] = { "error", "warn", "info", "debug" };
+
+void z_log_init(void)
+{
+	const char *v = z_getenv("FDL_LOG");
+	int i;
+
+	if (!v || !*v)
+		return;
+	if (v[0] >= '0' && v[0] <= '3' && !v[1])
+	{
+		z_log_level = v[0] - '0';
+		return;
+	}
+	for (i = Z_LOG_ERR; i <= Z_LOG_DEBUG; i++)
+		if (!z_strcmp(v, g_names[i]))
+			z_log_level = i;
+}
+
+static void lock(void)
+{
+	while (__atomic_exchange_n(&g_lock, 1, __ATOMIC_ACQUIRE))
+		z_cpu_relax();
+}
+
+static void unlock(void)
+{
+	__atomic_store_n(&g_lock, 0, __ATOMIC_RELEASE);
+}
+
+/* With the lock held. */
+static void flush_locked(void)
+{
+	if (g_len)
+		z_write(LOG_FD, g_buf, g_len);
+	g_len = 0;
+}
+
+void z_log_flush(void)
+{
+	lock();
+	flush_locked();
+	unlock();
+}
+
+void z_log_emit(int level, const char *fmt, ...)
+{
+	char line[LOG_LINE];
+	struct iovec iov[2];
+	va_list ap;
+	size_t n;
+
+	va_start(ap, fmt);
+	n = z_vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (n >= sizeof(line))
+	{
+		n = sizeof(line) - 1;
+		line[n - 1] = '\n';
+	}
+
+	lock();
+	if (g_len + n <= sizeof(g_buf))
+	{
+		z_memcpy(g_buf + g_len, line, n);
+		g_len += n;
+		if (level == Z_LOG_ERR)
+			flush_locked();
+		unlock();
+		return;
+	}
+	/* Full: out with what we have and this record, in one syscall. */
+	iov[0].iov_base = g_buf;
+	iov[0].iov_len = g_len;
+	iov[1].iov_base = line;
+	iov[1].iov_len = n;
+	z_writev(LOG_FD, iov, 2);
+	g_len = 0;
+	unlock();
+}
@@ -0,0 +1,64 @@
+#ifndef Z_LOG_H
+#define Z_LOG_H
+
+/*
+ * Leveled logging. Records are collected in a buffer and written out by
+ * z_log_flush() at the end of each phase (exec, resolve), or right away
+ * for errors. The runtime level comes from FDL_LOG (error, warn, info,
+ * debug or 0-3) and defaults to errors only. Calls above Z_LOG_MAX are
+ * compiled out, release builds keep everything up to info.
+ */
+
+#define Z_LOG_ERR 0
+#define Z_LOG_WARN 1
+#define Z_LOG_INFO 2
+#define Z_LOG_DEBUG 3
+
+#ifndef Z_LOG_MAX
+#define Z_LOG_MAX Z_LOG_INFO
+#endif
+
+#ifdef Z_SMALL
+static inline void z_log_discard(int level, ...)
+{
+	(void)level;
+}
+
+/* Nothing is logged or computed, the arguments only stay referenced. */
+#define z_log(level, ...)                          \
+	do                                             \
+	{                                              \
+		if (0)                                     \
+			z_log_discard((level), __VA_ARGS__);   \
+	} while (0)
+#define z_log_init() \
+	do               \
+	{                \
+	} while (0)
+#define z_log_flush() \
+	do                \
+	{                 \
+	} while (0)
+#else
+extern int z_log_level;
+
+#define z_log(level, ...)                                     \
+	do                                                        \
+	{                                                         \
+		if ((level) <= Z_LOG_MAX && (level) <= z_log_level) \
+			z_log_emit((level), __VA_ARGS__);                 \
+	} while (0)
+
+/* Reads FDL_LOG, needs z_environ. */
+void z_log_init(void);
+void z_log_emit(int level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void z_log_flush(void);
+#endif
+
+#define z_err(...) z_log(Z_LOG_ERR, __VA_ARGS__)
+#define z_warn(...) z_log(Z_LOG_WARN, __VA_ARGS__)
+#define z_info(...) z_log(Z_LOG_INFO, __VA_ARGS__)
+#define z_debug(...) z_log(Z_LOG_DEBUG, __VA_ARGS__)
+
+#endif /* Z_LOG_H */
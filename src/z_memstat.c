@@ -0,0 +1,271 @@
+#include "z_memstat.h"
+#include "z_asm.h"
+#include "z_syscalls.h"
+#include "z_trace.h"
+#include "z_utils.h"
+#include "fdl_resolve.h"
+
+#define PAGE_MASK 4095UL
+
+enum
+{
+	R_LOADER,
+	R_HOST,
+	R_INTERP,
+	R_LIBC,
+	R_LIB,
+	R_STACK,
+	R_HEAP,
+	R_ANON,
+	R_OTHER,
+	R_TOTAL,
+	R_MAX
+};
+
+static const char *const g_names[R_MAX] = {
+	"loader", "host", "interp", "libc", "lib", "stack", "heap", "anon", "other", "total",
+};
+
+typedef struct
+{
+	unsigned long mappings, size, rss, pss, shared, private, swap;
+	unsigned long pss_anon, pss_file;
+} stat_t;
+
+typedef struct
+{
+	unsigned long lo, hi;
+	int region;
+} range_t;
+
+extern const char __ehdr_start[] PRIVATE;
+extern const char _end[] PRIVATE;
+
+static range_t g_images[Z_MEMSTAT_IMAGES];
+static uint32_t g_nimages;
+static uint32_t g_dumped;
+static stat_t g_stats[R_MAX];
+
+static void image_range(Elf_Ehdr *ehdr, Elf_Phdr *phdr, unsigned long bias,
+						unsigned long *lo, unsigned long *hi)
+{
+	*lo = ~0UL;
+	*hi = 0;
+	for (Elf_Phdr *ph = phdr; ph < &phdr[ehdr->e_phnum]; ph++)
+	{
+		if (ph->p_type != PT_LOAD)
+			continue;
+		if (bias + ph->p_vaddr < *lo)
+			*lo = bias + ph->p_vaddr;
+		if (bias + ph->p_vaddr + ph->p_memsz > *hi)
+			*hi = bias + ph->p_vaddr + ph->p_memsz;
+	}
+	*lo &= ~PAGE_MASK;
+	*hi = (*hi + PAGE_MASK) & ~PAGE_MASK;
+}
+
+static void add_image(int region, Elf_Ehdr *ehdr, Elf_Phdr *phdr, unsigned long bias)
+{
+	uint32_t n = __atomic_load_n(&g_nimages, __ATOMIC_ACQUIRE);
+
+	if (n == Z_MEMSTAT_IMAGES)
+		return;
+	if (ehdr->e_type != ET_DYN)
+		bias = 0;
+	image_range(ehdr, phdr, bias, &g_images[n].lo, &g_images[n].hi);
+	g_images[n].region = region;
+	__atomic_store_n(&g_nimages, n + 1, __ATOMIC_RELEASE);
+}
+
+void z_memstat_image(const char *region, Elf_Ehdr *ehdr, Elf_Phdr *phdr,
+					 unsigned long bias)
+{
+	add_image(z_strcmp(region, "interp") ? R_HOST : R_INTERP, ehdr, phdr, bias);
+}
+
+static int hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static const char *skip_field(const char *p)
+{
+	while (*p && *p != ' ')
+		p++;
+	while (*p == ' ')
+		p++;
+	return p;
+}
+
+/* The region of a mapping, from its smaps header line. */
+static int classify(const char *line)
+{
+	unsigned long lo = 0, loader_lo = (unsigned long)__ehdr_start & ~PAGE_MASK;
+	uint32_t n = __atomic_load_n(&g_nimages, __ATOMIC_ACQUIRE);
+	const char *name = line;
+	int v;
+
+	for (; (v = hexval(*name)) >= 0; name++)
+		lo = lo * 16 + v;
+	/* end perms offset dev inode */
+	for (int i = 0; i < 5; i++)
+		name = skip_field(name);
+
+	if (lo >= loader_lo && lo < (unsigned long)_end)
+		return R_LOADER;
+	for (uint32_t i = 0; i < n; i++)
+		if (lo >= g_images[i].lo && lo < g_images[i].hi)
+			return g_images[i].region;
+	if (*name == '/')
+		return R_LIB;
+	if (!z_strcmp(name, "[stack]"))
+		return R_STACK;
+	if (!z_strcmp(name, "[heap]"))
+		return R_HEAP;
+	return *name ? R_OTHER : R_ANON;
+}
+
+/* "Rss:     48 kB" */
+static void add_key(stat_t *st, const char *line)
+{
+	static const struct
+	{
+		const char *key;
+		size_t off;
+	} keys[] = {
+		{ "Size:", __builtin_offsetof(stat_t, size) },
+		{ "Rss:", __builtin_offsetof(stat_t, rss) },
+		{ "Pss:", __builtin_offsetof(stat_t, pss) },
+		{ "Pss_Anon:", __builtin_offsetof(stat_t, pss_anon) },
+		{ "Pss_File:", __builtin_offsetof(stat_t, pss_file) },
+		{ "Shared_Clean:", __builtin_offsetof(stat_t, shared) },
+		{ "Shared_Dirty:", __builtin_offsetof(stat_t, shared) },
+		{ "Private_Clean:", __builtin_offsetof(stat_t, private) },
+		{ "Private_Dirty:", __builtin_offsetof(stat_t, private) },
+		{ "Swap:", __builtin_offsetof(stat_t, swap) },
+	};
+
+	for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+	{
+		const char *k = keys[i].key, *p = line;
+		unsigned long v = 0;
+
+		while (*k && *k == *p)
+			k++, p++;
+		if (*k)
+			continue;
+		while (*p == ' ')
+			p++;
+		for (; *p >= '0' && *p <= '9'; p++)
+			v = v * 10 + (*p - '0');
+		*(unsigned long *)((char *)st + keys[i].off) += v;
+		return;
+	}
+}
+
+/* Both files: a header line per mapping, the rollup has a single one,
+ * then "Key: value kB" lines. */
+static void scan(const char *path, int rollup)
+{
+	char buf[4096];
+	stat_t *st = NULL;
+	size_t len = 0;
+	ssize_t r;
+	int fd, eof = 0;
+
+	if ((fd = z_open(path, O_RDONLY)) < 0)
+		return;
+	for (;;)
+	{
+		char *nl;
+
+		buf[len] = 0;
+		for (nl = buf; *nl && *nl != '\n'; nl++)
+			;
+		/* Read only for a line that is not all in, and can fit. */
+		if (!*nl && !eof && len < sizeof(buf) - 1)
+		{
+			if ((r = z_read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+				len += r;
+			else
+				eof = 1;
+			continue;
+		}
+		if (!len)
+			break;
+		*nl = 0;
+		if (hexval(buf[0]) >= 0)
+		{
+			st = &g_stats[rollup ? R_TOTAL : classify(buf)];
+			st->mappings++;
+		}
+		else if (st)
+			add_key(st, buf);
+		if (nl < buf + len)
+			nl++;
+		len -= nl - buf;
+		for (size_t i = 0; i < len; i++)
+			buf[i] = nl[i];
+	}
+	z_close(fd);
+}
+
+static char *put_kv(char *p, const char *key, unsigned long v)
+{
+	p = z_fmt_str(p, key);
+	return z_fmt_ulong(p, v);
+}
+
+static char *put_region(char *p, int i)
+{
+	const stat_t *st = &g_stats[i];
+
+	p = z_fmt_str(p, "mem region=");
+	p = z_fmt_str(p, g_names[i]);
+	if (i != R_TOTAL)
+	{
+		p = put_kv(p, " mappings=", st->mappings);
+		p = put_kv(p, " size_kb=", st->size);
+	}
+	p = put_kv(p, " rss_kb=", st->rss);
+	p = put_kv(p, " pss_kb=", st->pss);
+	p = put_kv(p, " shared_kb=", st->shared);
+	p = put_kv(p, " private_kb=", st->private);
+	p = put_kv(p, " swap_kb=", st->swap);
+	if (i == R_TOTAL)
+	{
+		p = put_kv(p, " pss_anon_kb=", st->pss_anon);
+		p = put_kv(p, " pss_file_kb=", st->pss_file);
+	}
+	*p++ = '\n';
+	return p;
+}
+
+void z_memstat_dump(void)
+{
+	static char out[R_MAX * 192];
+	const char *v = z_getenv("FDL_MEMSTAT_FD");
+	fdl_mod_t *libc = fdl_libc_mod();
+	char *p = out;
+	int fd = 0;
+
+	if (!v || !*v || __atomic_exchange_n(&g_dumped, 1, __ATOMIC_RELAXED))
+		return;
+	for (; *v >= '0' && *v <= '9'; v++)
+		fd = fd * 10 + (*v - '0');
+	if (libc)
+		add_image(R_LIBC, libc->eh, libc->ph, libc->base);
+	scan("/proc/self/smaps_rollup", 1);
+	scan("/proc/self/smaps", 0);
+
+	p = put_region(p, R_TOTAL);
+	for (int i = 0; i < R_TOTAL; i++)
+		p = put_region(p, i);
+	z_write(fd, out, p - out);
+	/* Reading smaps is slow, keep it out of the next phase. */
+	z_trace("memstat", 0);
+}
@@ -0,0 +1,41 @@
+#ifndef Z_MEMSTAT_H
+#define Z_MEMSTAT_H
+
+/*
+ * Memory footprint report, built in with MEMSTAT=1 only. Once the foreign
+ * runtime is up, z_memstat_dump() reads /proc/self/smaps_rollup and
+ * /proc/self/smaps and writes to the fd in FDL_MEMSTAT_FD one line for
+ * the process, then one per region, always all of them and in this order:
+ *
+ *   mem region=total rss_kb=5120 pss_kb=1830 shared_kb=3944 private_kb=1176 swap_kb=0 pss_anon_kb=412 pss_file_kb=1418
+ *   mem region=loader mappings=4 size_kb=132 rss_kb=48 pss_kb=48 shared_kb=0 private_kb=48 swap_kb=0
+ *
+ * loader is our static image, host and interp what exec_elf() mapped,
+ * libc the object fdl_resolve found (musl's is counted as interp), lib
+ * any other file, stack the main stack, heap the brk heap, anon the rest
+ * without a name (thread stacks, mmap'd memory) and other the kernel's
+ * [vdso] and the like.
+ */
+
+#include "z_elf.h"
+
+#define Z_MEMSTAT_IMAGES 8
+
+#ifdef Z_MEMSTAT
+/* region is "host" or "interp", a string literal. */
+void z_memstat_image(const char *region, Elf_Ehdr *ehdr, Elf_Phdr *phdr,
+					 unsigned long bias);
+/* Writes once, later calls do nothing. */
+void z_memstat_dump(void);
+#else
+#define z_memstat_image(region, ehdr, phdr, bias) \
+	do                                            \
+	{                                             \
+	} while (0)
+#define z_memstat_dump() \
+	do                   \
+	{                    \
+	} while (0)
+#endif
+
+#endif /* Z_MEMSTAT_H */
@@ -0,0 +1,33 @@
+#include <limits.h>
+
+#include "z_once.h"
+#include "z_syscalls.h"
+
+enum
+{
+	ONCE_RUNNING = 1,
+	ONCE_WAITERS = 2,
+};
+
+void z_once_slow(z_once_t *once, void (*fn)(void *), void *arg)
+{
+	uint32_t st = Z_ONCE_INIT;
+
+	if (__atomic_compare_exchange_n(once, &st, ONCE_RUNNING, 0,
+									__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+	{
+		fn(arg);
+		if (__atomic_exchange_n(once, Z_ONCE_DONE, __ATOMIC_RELEASE) == ONCE_WAITERS)
+			z_futex_wake(once, INT_MAX);
+		return;
+	}
+	while (st != Z_ONCE_DONE)
+	{
+		/* Tell the runner somebody sleeps, then sleep. */
+		if (st == ONCE_WAITERS ||
+			__atomic_compare_exchange_n(once, &st, ONCE_WAITERS, 0,
+										__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+			z_futex_wait(once, ONCE_WAITERS);
+		st = __atomic_load_n(once, __ATOMIC_ACQUIRE);
+	}
+}
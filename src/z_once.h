@@ -0,0 +1,26 @@
+#ifndef Z_ONCE_H
+#define Z_ONCE_H
+
+#include <stdint.h>
+
+/*
+ * One-time initialization without libc. The first caller runs fn, the
+ * others sleep on the state futex until it is done. Whatever fn wrote is
+ * published to every caller that returns from z_once().
+ */
+
+#define Z_ONCE_INIT 0
+#define Z_ONCE_DONE 3
+
+typedef uint32_t z_once_t;
+
+void z_once_slow(z_once_t *once, void (*fn)(void *), void *arg);
+
+static inline void z_once(z_once_t *once, void (*fn)(void *), void *arg)
+{
+	/* After init this acquire load is all the callers pay. */
+	if (__atomic_load_n(once, __ATOMIC_ACQUIRE) != Z_ONCE_DONE)
+		z_once_slow(once, fn, arg);
+}
+
+#endif /* Z_ONCE_H */
@@ -0,0 +1,194 @@
+#include "z_perfmap.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+#include "z_log.h"
+
+#define PR_SET_VMA 0x53564d41
+#define PR_SET_VMA_ANON_NAME 0
+/* The kernel takes at most 80 bytes, terminator included. */
+#define VMA_NAME_MAX 80
+#define PAGE_SIZE 4096
+#define ROUND_PG(x) (((x) + PAGE_SIZE - 1) & ~(unsigned long)(PAGE_SIZE - 1))
+#define TRUNC_PG(x) ((x) & ~(unsigned long)(PAGE_SIZE - 1))
+
+static char g_out[8192];
+static size_t g_len;
+static int g_fd = -1;
+
+static void flush(void)
+{
+	if (g_len && g_fd >= 0)
+		z_write(g_fd, g_out, g_len);
+	g_len = 0;
+}
+
+/* Long names are cut, perf only shows them anyway. */
+static void put_entry(unsigned long addr, unsigned long size, const char *name,
+					  const char *suffix, unsigned long n)
+{
+	char line[256], *p = line, *end = line + sizeof(line) - 40;
+
+	p = z_fmt_hex(p, addr);
+	*p++ = ' ';
+	p = z_fmt_hex(p, size);
+	*p++ = ' ';
+	for (; *name && p < end; name++)
+		*p++ = *name;
+	if (suffix)
+	{
+		p = z_fmt_str(p, suffix);
+		p = z_fmt_hex(p, n);
+	}
+	*p++ = '\n';
+	if (g_len + (p - line) > sizeof(g_out))
+		flush();
+	z_memcpy(g_out + g_len, line, p - line);
+	g_len += p - line;
+}
+
+int z_perfmap_enabled(void)
+{
+	const char *v = z_getenv("FDL_PERFMAP");
+
+	return v && *v && !(v[0] == '0' && !v[1]);
+}
+
+/* Mapped from the file by loadelf_anon(). */
+static int file_backed(const Elf_Phdr *ph)
+{
+	return ph->p_filesz && (ph->p_offset & (PAGE_SIZE - 1)) == (ph->p_vaddr & (PAGE_SIZE - 1));
+}
+
+static int open_map(void)
+{
+	char path[32] = "/tmp/perf-", *p = path + 10;
+	char tmp[12], *t = tmp;
+	unsigned long pid, rem;
+
+	if (g_fd >= 0)
+		return g_fd;
+	pid = z_getpid();
+	do
+	{
+		pid = z_udivmod(pid, 10, &rem);
+		*t++ = '0' + rem;
+	} while (pid);
+	while (t > tmp)
+		*p++ = *--t;
+	z_fmt_str(p, ".map")[0] = 0;
+	g_fd = z_open_mode(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (g_fd < 0)
+		z_warn("perfmap: can't open %s\n", path);
+	return g_fd;
+}
+
+static void name_segments(const char *path, Elf_Ehdr *ehdr, Elf_Phdr *phdr,
+						  unsigned long bias)
+{
+	char name[VMA_NAME_MAX];
+	size_t n = 0;
+
+	/* Keep the tail of long paths, it has the file name. */
+	for (const char *s = path; *s; s++)
+		n++;
+	if (n > sizeof(name) - 1)
+		path += n - (sizeof(name) - 1);
+	for (n = 0; path[n]; n++)
+	{
+		char c = path[n];
+		/* Characters the kernel refuses in a name. */
+		name[n] = (c < 0x20 || c > 0x7e || c == '[' || c == ']' ||
+				   c == '\\' || c == '$' || c == '`')
+					  ? '_'
+					  : c;
+	}
+	name[n] = 0;
+	for (Elf_Phdr *ph = phdr; ph < &phdr[ehdr->e_phnum]; ph++)
+	{
+		unsigned long start = bias + TRUNC_PG(ph->p_vaddr);
+
+		if (ph->p_type != PT_LOAD)
+			continue;
+		z_prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, start,
+				ROUND_PG(bias + ph->p_vaddr + ph->p_memsz) - start,
+				(unsigned long)name);
+	}
+}
+
+/* Functions from the section headers, .symtab if it is still there. */
+static unsigned long put_symbols(int fd, unsigned long bias)
+{
+	unsigned long count = 0;
+	Elf_Ehdr *eh;
+	Elf_Shdr *sh, *tab = NULL;
+	off_t size = z_lseek(fd, 0, SEEK_END);
+	char *map;
+
+	if (size <= (off_t)sizeof(*eh))
+		return 0;
+	map = z_mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == (void *)-1)
+		return 0;
+	eh = (Elf_Ehdr *)map;
+	if (eh->e_shentsize != sizeof(*sh) || eh->e_shoff > (unsigned long)size ||
+		eh->e_shnum > (size - eh->e_shoff) / sizeof(*sh))
+		goto out;
+	sh = (Elf_Shdr *)(map + eh->e_shoff);
+	for (int i = 0; i < eh->e_shnum; i++)
+	{
+		if (sh[i].sh_type == SHT_SYMTAB)
+			tab = &sh[i];
+		else if (sh[i].sh_type == SHT_DYNSYM && !tab)
+			tab = &sh[i];
+	}
+	if (!tab || tab->sh_link >= eh->e_shnum ||
+		tab->sh_offset + tab->sh_size > (unsigned long)size ||
+		sh[tab->sh_link].sh_offset + sh[tab->sh_link].sh_size > (unsigned long)size)
+		goto out;
+	{
+		Elf_Sym *sym = (Elf_Sym *)(map + tab->sh_offset);
+		Elf_Sym *end = sym + tab->sh_size / sizeof(*sym);
+		const char *str = map + sh[tab->sh_link].sh_offset;
+		unsigned long strsz = sh[tab->sh_link].sh_size;
+
+		for (; sym < end; sym++)
+		{
+			int type = ELF_ST_TYPE(sym->st_info);
+
+			if ((type != STT_FUNC && type != STT_GNU_IFUNC) ||
+				sym->st_shndx == SHN_UNDEF || sym->st_size == 0 ||
+				sym->st_name >= strsz)
+				continue;
+			put_entry(bias + sym->st_value, sym->st_size, str + sym->st_name, NULL, 0);
+			count++;
+		}
+	}
+out:
+	z_munmap(map, size);
+	return count;
+}
+
+void z_perfmap_image(const char *path, int fd, Elf_Ehdr *ehdr, Elf_Phdr *phdr,
+					 unsigned long bias)
+{
+	unsigned long n = 0;
+	int copied = 0;
+
+	if (!z_perfmap_enabled())
+		return;
+	if (ehdr->e_type != ET_DYN)
+		bias = 0;
+	name_segments(path, ehdr, phdr, bias);
+	for (int i = 0; i < ehdr->e_phnum; i++)
+		copied |= phdr[i].p_type == PT_LOAD && (phdr[i].p_flags & PF_X) && !file_backed(&phdr[i]);
+	if (!copied || open_map() < 0)
+		return;
+	n = put_symbols(fd, bias);
+	for (int i = 0; n == 0 && i < ehdr->e_phnum; i++)
+	{
+		if (phdr[i].p_type == PT_LOAD && (phdr[i].p_flags & PF_X))
+			put_entry(bias + phdr[i].p_vaddr, phdr[i].p_memsz, path, ":seg", i);
+	}
+	flush();
+	z_info("perfmap: %s at 0x%lx, %lu symbols\n", path, bias, n);
+}
@@ -0,0 +1,36 @@
+#ifndef Z_PERFMAP_H
+#define Z_PERFMAP_H
+
+/*
+ * Profiler metadata for the images loadelf_anon() maps, built in with
+ * PERFMAP=1 only and turned on by setting FDL_PERFMAP (to anything but 0).
+ * loadelf_anon() then maps segments from the file wherever their offset
+ * allows, so /proc/<pid>/maps and perf see the path. Every PT_LOAD is also
+ * named after its file with PR_SET_VMA_ANON_NAME ([anon:<path>], on
+ * kernels with CONFIG_ANON_VMA_NAME). If executable code had to be copied
+ * into anonymous memory after all, the functions of the image's .symtab
+ * (or .dynsym) go to /tmp/perf-<pid>.map, the file perf reads for it:
+ *
+ *   7f3a1c02a9c0 1e5 _dl_start
+ *
+ * Images without function symbols get one entry per executable segment.
+ * PERFMAP=1 builds are not stripped, so perf names our own code too.
+ */
+
+#include "z_elf.h"
+
+#ifdef Z_PERFMAP
+/* FDL_PERFMAP is set, needs z_environ. */
+int z_perfmap_enabled(void);
+/* fd is the opened image, bias what loadelf_anon() returned for it. */
+void z_perfmap_image(const char *path, int fd, Elf_Ehdr *ehdr, Elf_Phdr *phdr,
+					 unsigned long bias);
+#else
+#define z_perfmap_enabled() 0
+#define z_perfmap_image(path, fd, ehdr, phdr, bias) \
+	do                                              \
+	{                                               \
+	} while (0)
+#endif
+
+#endif /* Z_PERFMAP_H */
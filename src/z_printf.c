@@ -3,60 +3,76 @@
 
 #include "z_syscalls.h"
 
-static int lastfd = -1;
 #define OUTBUFSIZE 128
-static char outbuf[OUTBUFSIZE];
-static char *outptr;
 
-static void kprintn(int, unsigned long, int);
-static void kdoprnt(int, const char *, va_list);
-static void z_flushbuf(void);
+/* Where kdoprnt() goes, on the caller's stack: any thread may print. */
+typedef struct
+{
+	int fd; /* -1: into sn only, see z_vsnprintf() */
+	char buf[OUTBUFSIZE];
+	size_t len;
+	char *sn;
+	size_t snlen, sncap;
+} out_t;
+
+static void kprintn(out_t *, unsigned long, int);
+static void kdoprnt(out_t *, const char *, va_list);
+static void z_flushbuf(out_t *);
 
-static void putcharfd(int, int);
+static void putcharfd(int, out_t *);
 
 static void
-putcharfd(int c, int fd)
+putcharfd(int c, out_t *o)
 {
 	char b = c;
-	int len;
 
-	if (fd != lastfd)
+	if (o->fd < 0)
 	{
-		z_flushbuf();
-		lastfd = fd;
+		if (o->snlen + 1 < o->sncap)
+			o->sn[o->snlen] = b;
+		o->snlen++;
+		return;
 	}
-	*outptr++ = b;
-	len = outptr - outbuf;
-	if ((len >= OUTBUFSIZE) || (b == '\n') || (b == '\r'))
+	o->buf[o->len++] = b;
+	if ((o->len >= OUTBUFSIZE) || (b == '\n') || (b == '\r'))
 	{
-		z_flushbuf();
+		z_flushbuf(o);
 	}
 }
 
 static void
-z_flushbuf()
+z_flushbuf(out_t *o)
 {
-	int len = outptr - outbuf;
-	if (len != 0)
+	if (o->len != 0)
 	{
-		if (lastfd != -1)
-			z_write(lastfd, outbuf, len);
-		outptr = outbuf;
+		if (o->fd >= 0)
+			z_write(o->fd, o->buf, o->len);
+		o->len = 0;
 	}
 }
 
+static void
+fdprnt(int fd, const char *fmt, va_list ap)
+{
+	out_t o;
+
+	o.fd = fd;
+	o.len = 0;
+	kdoprnt(&o, fmt, ap);
+}
+
 void z_printf(const char *fmt, ...)
 {
 	va_list ap;
 
 	va_start(ap, fmt);
-	kdoprnt(2, fmt, ap);
+	fdprnt(2, fmt, ap);
 	va_end(ap);
 }
 
 void z_vprintf(const char *fmt, va_list ap)
 {
-	kdoprnt(2, fmt, ap);
+	fdprnt(2, fmt, ap);
 }
 
 void z_fdprintf(int fd, const char *fmt, ...)
@@ -64,78 +80,98 @@ void z_fdprintf(int fd, const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	kdoprnt(fd, fmt, ap);
+	fdprnt(fd, fmt, ap);
 	va_end(ap);
 }
 
 void z_vfdprintf(int fd, const char *fmt, va_list ap)
 {
-	kdoprnt(fd, fmt, ap);
+	fdprnt(fd, fmt, ap);
+}
+
+int z_vsnprintf(char *buf, size_t size, const char *fmt, va_list ap)
+{
+	out_t o;
+
+	o.fd = -1;
+	o.len = 0;
+	o.sn = buf;
+	o.snlen = 0;
+	o.sncap = size;
+	kdoprnt(&o, fmt, ap);
+	if (size)
+		buf[o.snlen < size ? o.snlen : size - 1] = 0;
+	return o.snlen;
 }
 
 static void
-kdoprnt(int fd, const char *fmt, va_list ap)
+kdoprnt(out_t *o, const char *fmt, va_list ap)
 {
 	unsigned long ul;
-	int lflag, ch;
+	int lflag, prec, ch;
 	char *p;
-	static int init;
-
-	if (!init)
-	{
-		outptr = outbuf;
-		init = 1;
-	}
 
 	for (;;)
 	{
 		while ((ch = *fmt++) != '%')
 		{
 			if (ch == '\0')
+			{
+				z_flushbuf(o);
 				return;
-			putcharfd(ch, fd);
+			}
+			putcharfd(ch, o);
 		}
 		lflag = 0;
+		prec = -1;
 	reswitch:
 		switch (ch = *fmt++)
 		{
 		case 'l':
 			lflag = 1;
 			goto reswitch;
+		case '.':
+			/* Only "%.*s". */
+			if (*fmt == '*')
+			{
+				fmt++;
+				prec = va_arg(ap, int);
+			}
+			goto reswitch;
 		case 'c':
 			ch = va_arg(ap, int);
-			putcharfd(ch & 0x7f, fd);
+			putcharfd(ch & 0x7f, o);
 			break;
 		case 's':
 			p = va_arg(ap, char *);
-			while ((ch = *p++))
-				putcharfd(ch, fd);
+			while (prec-- != 0 && (ch = *p++))
+				putcharfd(ch, o);
 			break;
 		case 'd':
 			ul = lflag ? va_arg(ap, long) : va_arg(ap, int);
 			if ((long)ul < 0)
 			{
-				putcharfd('-', fd);
+				putcharfd('-', o);
 				ul = -(long)ul;
 			}
-			kprintn(fd, ul, 10);
+			kprintn(o, ul, 10);
 			break;
 		case 'o':
 			ul = lflag ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
-			kprintn(fd, ul, 8);
+			kprintn(o, ul, 8);
 			break;
 		case 'u':
 			ul = lflag ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
-			kprintn(fd, ul, 10);
+			kprintn(o, ul, 10);
 			break;
 		case 'p':
-			putcharfd('0', fd);
-			putcharfd('x', fd);
+			putcharfd('0', o);
+			putcharfd('x', o);
 			lflag += sizeof(void *) == sizeof(unsigned long) ? 1 : 0;
 			/* FALLTHRU */
 		case 'x':
 			ul = lflag ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
-			kprintn(fd, ul, 16);
+			kprintn(o, ul, 16);
 			break;
 		case 'X':
 		{
@@ -148,23 +184,23 @@ kdoprnt(int fd, const char *fmt, va_list ap)
 				l = (sizeof(unsigned int) * 8) - 4;
 			while (l >= 0)
 			{
-				putcharfd("0123456789abcdef"[(ul >> l) & 0xf], fd);
+				putcharfd("0123456789abcdef"[(ul >> l) & 0xf], o);
 				l -= 4;
 			}
 			break;
 		}
 		default:
-			putcharfd('%', fd);
+			putcharfd('%', o);
 			if (lflag)
-				putcharfd('l', fd);
-			putcharfd(ch, fd);
+				putcharfd('l', o);
+			putcharfd(ch, o);
 		}
 	}
-	z_flushbuf();
+	z_flushbuf(o);
 }
 
 static void
-kprintn(int fd, unsigned long ul, int base)
+kprintn(out_t *o, unsigned long ul, int base)
 {
 	// rewrote to avoid div
 	char buf[(sizeof(long) * 8 / 3) + 1], *p = buf;
@@ -202,6 +238,6 @@ kprintn(int fd, unsigned long ul, int base)
 
 	do
 	{
-		putcharfd(*--p, fd);
+		putcharfd(*--p, o);
 	} while (p > buf);
 }
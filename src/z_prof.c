@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <sys/ucontext.h>
+
+#include "z_prof.h"
+#include "z_asm.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+
+#if defined(__x86_64__)
+#define UC_PC(uc) ((uc)->uc_mcontext.gregs[REG_RIP])
+#elif defined(__i386__)
+#define UC_PC(uc) ((uc)->uc_mcontext.gregs[REG_EIP])
+#elif defined(__aarch64__)
+#define UC_PC(uc) ((uc)->uc_mcontext.pc)
+#elif defined(__arm__)
+#define UC_PC(uc) ((uc)->uc_mcontext.arm_pc)
+#endif
+
+#define MAPS_MAX 1024
+
+typedef struct
+{
+	unsigned long lo, hi;
+	const char *name;
+	unsigned long samples;
+} range_t;
+
+extern const char __ehdr_start[] PRIVATE;
+extern const char _end[] PRIVATE;
+
+static unsigned long g_ring[Z_PROF_SAMPLES];
+static uint32_t g_head;
+static unsigned long g_hz;
+static pid_t g_pid;
+static int g_timer;
+static char g_names[Z_PROF_MODULES][128];
+static range_t g_mods[Z_PROF_MODULES];
+static uint32_t g_nmods;
+static char g_maps[65536];
+static range_t g_ranges[MAPS_MAX];
+
+static void on_sigprof(int sig, void *si, void *ctx)
+{
+	uint32_t i = __atomic_fetch_add(&g_head, 1, __ATOMIC_RELAXED);
+
+	(void)sig;
+	(void)si;
+	g_ring[i & (Z_PROF_SAMPLES - 1)] = UC_PC((ucontext_t *)ctx);
+}
+
+void z_prof_init(void)
+{
+	const char *v = z_getenv("FDL_PROF");
+	struct z_sigaction sa;
+	struct sigevent sev;
+	struct itimerspec it;
+
+	if (!v || !*v || g_hz)
+		return;
+	g_hz = 0;
+	for (; *v >= '0' && *v <= '9'; v++)
+		g_hz = g_hz * 10 + (*v - '0');
+	if (g_hz == 1)
+		g_hz = 1000;
+	if (g_hz == 0)
+		return;
+	g_pid = z_getpid();
+	z_memset(&sa, 0, sizeof(sa));
+	sa.handler = on_sigprof;
+	sa.flags = SA_SIGINFO | SA_RESTART;
+	if (z_rt_sigaction(SIGPROF, &sa, NULL) < 0)
+	{
+		g_hz = 0;
+		return;
+	}
+	z_memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_SIGNAL;
+	sev.sigev_signo = SIGPROF;
+	it.it_interval.tv_sec = 0;
+	it.it_interval.tv_nsec = g_hz > 1000000000 ? 1 : z_udivmod(1000000000, g_hz, NULL);
+	it.it_value = it.it_interval;
+	if (z_timer_create(CLOCK_PROCESS_CPUTIME_ID, &sev, &g_timer) < 0 ||
+		z_timer_settime(g_timer, 0, &it, NULL) < 0)
+		g_hz = 0;
+}
+
+void z_prof_image(const char *name, Elf_Ehdr *ehdr, Elf_Phdr *phdr,
+				  unsigned long bias)
+{
+	uint32_t n = __atomic_load_n(&g_nmods, __ATOMIC_ACQUIRE);
+	unsigned long lo = ~0UL, hi = 0;
+	size_t k;
+
+	if (!g_hz || n == Z_PROF_MODULES)
+		return;
+	if (ehdr->e_type != ET_DYN)
+		bias = 0;
+	for (Elf_Phdr *ph = phdr; ph < &phdr[ehdr->e_phnum]; ph++)
+	{
+		if (ph->p_type != PT_LOAD)
+			continue;
+		if (bias + ph->p_vaddr < lo)
+			lo = bias + ph->p_vaddr;
+		if (bias + ph->p_vaddr + ph->p_memsz > hi)
+			hi = bias + ph->p_vaddr + ph->p_memsz;
+	}
+	/* The name may not outlive exec_elf(), keep a copy. */
+	for (k = 0; name[k] && k < sizeof(g_names[n]) - 1; k++)
+		g_names[n][k] = name[k];
+	g_names[n][k] = 0;
+	g_mods[n].lo = lo;
+	g_mods[n].hi = hi;
+	g_mods[n].name = g_names[n];
+	__atomic_store_n(&g_nmods, n + 1, __ATOMIC_RELEASE);
+}
+
+static char *hex(char *p, unsigned long *v)
+{
+	for (; (*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f'); p++)
+		*v = *v * 16 + (*p <= '9' ? *p - '0' : *p - 'a' + 10);
+	return p;
+}
+
+/* Mappings with a name, from /proc/self/maps. */
+static uint32_t read_maps(void)
+{
+	uint32_t n = 0;
+	ssize_t len = 0, r;
+	char *p, *end;
+	int fd;
+
+	if ((fd = z_open("/proc/self/maps", O_RDONLY)) < 0)
+		return 0;
+	while (len < (ssize_t)sizeof(g_maps) - 1 &&
+		   (r = z_read(fd, g_maps + len, sizeof(g_maps) - 1 - len)) > 0)
+		len += r;
+	z_close(fd);
+	g_maps[len > 0 ? len : 0] = 0;
+	for (p = g_maps; *p && n < MAPS_MAX; p = end)
+	{
+		unsigned long lo = 0, hi = 0;
+		char *name = NULL;
+		int field = 0;
+
+		for (end = p; *end && *end != '\n'; end++)
+			;
+		if (*end)
+			*end++ = 0;
+		p = hex(p, &lo);
+		if (*p++ != '-')
+			continue;
+		p = hex(p, &hi);
+		/* perms offset dev inode name */
+		for (; *p && field < 5; field++)
+		{
+			while (*p == ' ')
+				p++;
+			name = p;
+			while (*p && *p != ' ')
+				p++;
+		}
+		while (name && *name == ' ')
+			name++;
+		if (field == 5 && name && *name)
+		{
+			g_ranges[n].lo = lo;
+			g_ranges[n].hi = hi;
+			g_ranges[n].name = name;
+			g_ranges[n].samples = 0;
+			n++;
+		}
+	}
+	return n;
+}
+
+static range_t *find(range_t *r, uint32_t n, unsigned long pc)
+{
+	for (uint32_t i = 0; i < n; i++)
+		if (pc >= r[i].lo && pc < r[i].hi)
+			return &r[i];
+	return NULL;
+}
+
+void z_prof_dump(int fd)
+{
+	static range_t self = { 0, 0, "[static]", 0 }, anon = { 0, 0, "[anon]", 0 };
+	static range_t *out[Z_PROF_MODULES + MAPS_MAX + 2];
+	uint32_t head, count, nmods, nmaps, nout = 0;
+	unsigned long lost, hz = g_hz;
+	char line[256], *p;
+
+	if (!g_hz || z_getpid() != g_pid)
+		return;
+	z_timer_delete(g_timer);
+	g_hz = 0;
+	head = __atomic_load_n(&g_head, __ATOMIC_ACQUIRE);
+	count = head < Z_PROF_SAMPLES ? head : Z_PROF_SAMPLES;
+	lost = head - count;
+	nmods = __atomic_load_n(&g_nmods, __ATOMIC_ACQUIRE);
+	nmaps = read_maps();
+	self.lo = (unsigned long)__ehdr_start;
+	self.hi = (unsigned long)_end;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		unsigned long pc = g_ring[i];
+		range_t *r = pc >= self.lo && pc < self.hi ? &self : find(g_mods, nmods, pc);
+
+		if (!r)
+			r = find(g_ranges, nmaps, pc);
+		(r ? r : &anon)->samples++;
+	}
+
+	/* One line per name, most samples first. */
+	out[nout++] = &self;
+	out[nout++] = &anon;
+	for (uint32_t i = 0; i < nmods + nmaps; i++)
+		out[nout++] = i < nmods ? &g_mods[i] : &g_ranges[i - nmods];
+	for (uint32_t i = 0; i < nout; i++)
+	{
+		for (uint32_t j = i + 1; j < nout && out[i]->samples; j++)
+		{
+			if (out[j]->samples && !z_strcmp(out[i]->name, out[j]->name))
+			{
+				out[i]->samples += out[j]->samples;
+				out[j]->samples = 0;
+			}
+		}
+	}
+	for (uint32_t i = 1; i < nout; i++)
+	{
+		range_t *r = out[i];
+		uint32_t j = i;
+
+		for (; j > 0 && out[j - 1]->samples < r->samples; j--)
+			out[j] = out[j - 1];
+		out[j] = r;
+	}
+
+	p = z_fmt_str(line, "prof samples=");
+	p = z_fmt_ulong(p, count);
+	p = z_fmt_str(p, " lost=");
+	p = z_fmt_ulong(p, lost);
+	p = z_fmt_str(p, " hz=");
+	p = z_fmt_ulong(p, hz);
+	p = z_fmt_str(p, " static=");
+	p = z_fmt_ulong(p, self.samples);
+	p = z_fmt_str(p, " foreign=");
+	p = z_fmt_ulong(p, count - self.samples);
+	*p++ = '\n';
+	z_write(fd, line, p - line);
+	for (uint32_t i = 0; i < nout && out[i]->samples; i++)
+	{
+		p = z_fmt_str(line, "prof module=");
+		for (const char *s = out[i]->name; *s && p < line + sizeof(line) - 64; s++)
+			*p++ = *s;
+		p = z_fmt_str(p, " samples=");
+		p = z_fmt_ulong(p, out[i]->samples);
+		p = z_fmt_str(p, " pct=");
+		p = z_fmt_ulong(p, z_udivmod(out[i]->samples * 100, count, NULL));
+		*p++ = '\n';
+		z_write(fd, line, p - line);
+	}
+}
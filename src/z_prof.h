@@ -0,0 +1,49 @@
+#ifndef Z_PROF_H
+#define Z_PROF_H
+
+/*
+ * SIGPROF sampler, built in with PROF=1 only and started from our entry
+ * when FDL_PROF is set: 1 samples at 1000 Hz, anything larger is the rate.
+ * It owes nothing to the foreign libc: the handler goes in with a raw
+ * rt_sigaction() and a process CPU-time timer counts every thread, from
+ * before ld.so runs. Unlike ITIMER_PROF, the timer goes away on execve(),
+ * so children the foreign side runs are not killed by SIGPROF.
+ * Interrupted PCs go to a preallocated ring.
+ *
+ * z_prof_dump(), from z_exit() and the loader's fini, stops the timer and
+ * attributes the samples to our static image, the images registered with
+ * z_prof_image() (what loadelf_anon() mapped), then whatever
+ * /proc/self/maps says, and prints a per-module summary:
+ *
+ *   prof samples=1210 lost=0 hz=1000 static=96 foreign=1114
+ *   prof module=/usr/lib/x86_64-linux-gnu/libc.so.6 samples=702 pct=58
+ */
+
+#include "z_elf.h"
+
+#define Z_PROF_SAMPLES 65536 /* power of two */
+#define Z_PROF_MODULES 32
+
+#ifdef Z_PROF
+/* Reads FDL_PROF, needs z_environ. */
+void z_prof_init(void);
+void z_prof_image(const char *name, Elf_Ehdr *ehdr, Elf_Phdr *phdr,
+				  unsigned long bias);
+/* Once, from the process that started the sampler. */
+void z_prof_dump(int fd);
+#else
+#define z_prof_init() \
+	do                \
+	{                 \
+	} while (0)
+#define z_prof_image(name, ehdr, phdr, bias) \
+	do                                       \
+	{                                        \
+	} while (0)
+#define z_prof_dump(fd) \
+	do                  \
+	{                   \
+	} while (0)
+#endif
+
+#endif /* Z_PROF_H */
@@ -0,0 +1,112 @@
+#ifndef Z_SIMD_H
+#define Z_SIMD_H
+
+/*
+ * 16-byte vector helpers for z_utils.c. Z_VEC is defined when the arch has
+ * them. Where the vector unit is optional (i386, arm) the helpers carry a
+ * target attribute and callers check z_simd first, which z_cpu_init() sets
+ * from AT_HWCAP.
+ */
+
+#include <stdint.h>
+
+#define ZV_SIZE 16
+
+#if defined(__x86_64__) || defined(__i386__)
+#define Z_VEC 1
+#include <emmintrin.h>
+
+#ifdef __SSE2__
+#define ZV_TARGET
+#else
+#define ZV_TARGET __attribute__((target("sse2")))
+#endif
+
+typedef __m128i zv_t;
+
+static inline ZV_TARGET zv_t zv_load(const void *p)
+{
+	return _mm_load_si128((const __m128i *)p);
+}
+
+static inline ZV_TARGET zv_t zv_loadu(const void *p)
+{
+	return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline ZV_TARGET void zv_storeu(void *p, zv_t v)
+{
+	_mm_storeu_si128((__m128i *)p, v);
+}
+
+static inline ZV_TARGET zv_t zv_splat(int c)
+{
+	return _mm_set1_epi8((char)c);
+}
+
+/* Any byte of a that is zero or differs from b? */
+static inline ZV_TARGET int zv_stop(zv_t a, zv_t b)
+{
+	zv_t z = _mm_cmpeq_epi8(a, _mm_setzero_si128());
+	return _mm_movemask_epi8(_mm_andnot_si128(z, _mm_cmpeq_epi8(a, b))) != 0xffff;
+}
+
+/* Any byte of a that is zero or equal to c? */
+static inline ZV_TARGET int zv_hit(zv_t a, zv_t c)
+{
+	zv_t z = _mm_cmpeq_epi8(a, _mm_setzero_si128());
+	return _mm_movemask_epi8(_mm_or_si128(z, _mm_cmpeq_epi8(a, c))) != 0;
+}
+
+#elif defined(__aarch64__) || (defined(__arm__) && defined(__ARM_NEON))
+#define Z_VEC 1
+#include <arm_neon.h>
+
+#define ZV_TARGET
+
+typedef uint8x16_t zv_t;
+
+static inline zv_t zv_load(const void *p)
+{
+	return vld1q_u8((const uint8_t *)__builtin_assume_aligned(p, ZV_SIZE));
+}
+
+static inline zv_t zv_loadu(const void *p)
+{
+	return vld1q_u8((const uint8_t *)p);
+}
+
+static inline void zv_storeu(void *p, zv_t v)
+{
+	vst1q_u8((uint8_t *)p, v);
+}
+
+static inline zv_t zv_splat(int c)
+{
+	return vdupq_n_u8((uint8_t)c);
+}
+
+static inline int zv_any(zv_t m)
+{
+#ifdef __aarch64__
+	return vmaxvq_u8(m) != 0;
+#else
+	uint8x8_t t = vorr_u8(vget_low_u8(m), vget_high_u8(m));
+	return vget_lane_u64(vreinterpret_u64_u8(t), 0) != 0;
+#endif
+}
+
+static inline int zv_stop(zv_t a, zv_t b)
+{
+	zv_t z = vceqq_u8(a, vdupq_n_u8(0));
+	return zv_any(vorrq_u8(z, vmvnq_u8(vceqq_u8(a, b))));
+}
+
+static inline int zv_hit(zv_t a, zv_t c)
+{
+	return zv_any(vorrq_u8(vceqq_u8(a, vdupq_n_u8(0)), vceqq_u8(a, c)));
+}
+
+#endif
+
+#endif /* Z_SIMD_H */
@@ -1,7 +1,11 @@
 #include <syscall.h>
+#include <signal.h>
+#include <linux/futex.h>
 
 #include "z_asm.h"
 #include "z_syscalls.h"
+#include "z_prof.h"
+#include "z_log.h"
 
 static int errno;
 
@@ -19,7 +23,85 @@ static long check_error(long rc)
 	return rc;
 }
 
-#define SYSCALL(name, ...)  check_error(z_syscall(SYS_##name, __VA_ARGS__))
+#ifdef Z_STATS
+/* Per wrapper accounting, a record links itself in on its first call. */
+typedef struct z_stat
+{
+	const char *name;
+	unsigned long calls;
+	unsigned long bytes;
+	uint64_t ticks;
+	struct z_stat *next;
+	uint32_t linked;
+} z_stat_t;
+
+static z_stat_t *g_stats;
+/* Counter and clock at the first call, to scale ticks in the summary. */
+static uint64_t g_tick0;
+static struct timespec g_ts0;
+
+static inline uint64_t z_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+	__asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+	uint64_t v;
+	__asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(v));
+	return v;
+#else
+	/* armv7 may not let us read the generic timer, pay for a syscall. */
+	struct timespec ts;
+	z_syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void stat_add(z_stat_t *st, uint64_t ticks, unsigned long bytes)
+{
+	uint32_t no = 0;
+
+	if (!g_tick0)
+	{
+		z_syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &g_ts0);
+		g_tick0 = z_ticks();
+	}
+	__atomic_fetch_add(&st->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->ticks, ticks, __ATOMIC_RELAXED);
+	if (__atomic_compare_exchange_n(&st->linked, &no, 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+		st->next = __atomic_load_n(&g_stats, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&g_stats, &st->next, st, 1,
+											__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+}
+
+/* bytes is an expression of rc_, the raw syscall result. */
+#define STAT_SYSCALL(name, bytes, ...)                           \
+	({                                                           \
+		static z_stat_t st_ = { #name, 0, 0, 0, NULL, 0 };      \
+		uint64_t t0_ = z_ticks();                                \
+		long rc_ = z_syscall(SYS_##name, __VA_ARGS__);           \
+		stat_add(&st_, z_ticks() - t0_, (bytes));                \
+		check_error(rc_);                                        \
+	})
+#else
+#define STAT_SYSCALL(name, bytes, ...) check_error(z_syscall(SYS_##name, __VA_ARGS__))
+#endif
+
+#define SYSCALL(name, ...) STAT_SYSCALL(name, 0, __VA_ARGS__)
+/* Transfers, accounted by what the kernel reports. */
+#define SYSCALL_IO(name, ...) STAT_SYSCALL(name, rc_ > 0 ? (unsigned long)rc_ : 0, __VA_ARGS__)
+/* Mapping calls, accounted by the length asked for. */
+#define SYSCALL_LEN(name, len, ...) STAT_SYSCALL(name, (unsigned long)(len), __VA_ARGS__)
+#define DEF_SYSCALL0(ret, name) \
+ret z_##name(void) \
+{ \
+	return (ret)SYSCALL(name, 0); \
+}
 #define DEF_SYSCALL1(ret, name, t1, a1) \
 ret z_##name(t1 a1) \
 { \
@@ -35,15 +117,115 @@ ret z_##name(t1 a1, t2 a2, t3 a3) \
 { \
 	return (ret)SYSCALL(name, a1, a2, a3); \
 }
+#define DEF_SYSCALL4(ret, name, t1, a1, t2, a2, t3, a3, t4, a4) \
+ret z_##name(t1 a1, t2 a2, t3 a3, t4 a4) \
+{ \
+	return (ret)SYSCALL(name, a1, a2, a3, a4); \
+}
 
-DEF_SYSCALL1(void, exit, int, status)
 DEF_SYSCALL2(int, open, const char *, filename, int, flags)
-DEF_SYSCALL3(ssize_t, read, int, fd, void *, buf, size_t, count)
-DEF_SYSCALL3(ssize_t, write, int, fd, const void *, buf, size_t, count)
 DEF_SYSCALL1(int, close, int, fd)
 DEF_SYSCALL3(int, lseek, int, fd, off_t, off, int, whence)
-DEF_SYSCALL2(int, munmap, void *, addr, size_t, length)
-DEF_SYSCALL3(int, mprotect, void *, addr, size_t, length, int, prot)
+DEF_SYSCALL3(int, madvise, void *, addr, size_t, length, int, advice)
+DEF_SYSCALL0(pid_t, getpid)
+DEF_SYSCALL2(int, kill, pid_t, pid, int, sig)
+DEF_SYSCALL2(int, ftruncate, int, fd, off_t, length)
+DEF_SYSCALL2(int, memfd_create, const char *, name, unsigned int, flags)
+DEF_SYSCALL4(pid_t, wait4, pid_t, pid, int *, status, int, options, void *, rusage)
+DEF_SYSCALL2(int, clock_gettime, clockid_t, clk, struct timespec *, ts)
+DEF_SYSCALL3(int, sched_getaffinity, pid_t, pid, size_t, size, void *, mask)
+DEF_SYSCALL3(int, sched_setaffinity, pid_t, pid, size_t, size, const void *, mask)
+DEF_SYSCALL3(int, execve, const char *, path, char *const *, argv, char *const *, envp)
+DEF_SYSCALL2(int, pipe2, int *, fds, int, flags)
+DEF_SYSCALL3(int, dup3, int, oldfd, int, newfd, int, flags)
+DEF_SYSCALL4(long, ptrace, long, req, pid_t, pid, void *, addr, void *, data)
+DEF_SYSCALL3(int, getdents64, int, fd, void *, buf, size_t, count)
+DEF_SYSCALL3(int, timer_create, clockid_t, clock, struct sigevent *, sev, int *, id)
+DEF_SYSCALL4(int, timer_settime, int, id, int, flags, const struct itimerspec *, val,
+			 struct itimerspec *, old)
+DEF_SYSCALL1(int, timer_delete, int, id)
+
+#ifndef SA_RESTORER
+#define SA_RESTORER 0x04000000
+#endif
+
+int z_rt_sigaction(int sig, struct z_sigaction *act, struct z_sigaction *old)
+{
+	if (act)
+	{
+		act->flags |= SA_RESTORER;
+		act->restorer = z_sigreturn;
+	}
+	return (int)SYSCALL(rt_sigaction, sig, act, old, sizeof(act->mask));
+}
+
+int z_open_mode(const char *pathname, int flags, int mode)
+{
+	return (int)SYSCALL(open, pathname, flags, mode);
+}
+
+int z_prctl(int option, unsigned long a2, unsigned long a3, unsigned long a4,
+			unsigned long a5)
+{
+	return (int)SYSCALL(prctl, option, a2, a3, a4, a5);
+}
+
+ssize_t z_read(int fd, void *buf, size_t count)
+{
+	return (ssize_t)SYSCALL_IO(read, fd, buf, count);
+}
+
+ssize_t z_write(int fd, const void *buf, size_t count)
+{
+	return (ssize_t)SYSCALL_IO(write, fd, buf, count);
+}
+
+ssize_t z_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	return (ssize_t)SYSCALL_IO(writev, fd, iov, iovcnt);
+}
+
+int z_munmap(void *addr, size_t length)
+{
+	return (int)SYSCALL_LEN(munmap, length, addr, length);
+}
+
+int z_mprotect(void *addr, size_t length, int prot)
+{
+	return (int)SYSCALL_LEN(mprotect, length, addr, length, prot);
+}
+
+void z_exit(int status)
+{
+	z_log_flush();
+	z_prof_dump(2);
+	z_stats_dump(2);
+	/* The whole process, foreign threads (pool workers) included. */
+	SYSCALL(exit_group, status);
+}
+
+pid_t z_fork(void)
+{
+	/* There is no fork on aarch64, clone with only SIGCHLD is the same
+	 * thing everywhere and flags come first on every arch we support.
+	 */
+	return (pid_t)SYSCALL(clone, SIGCHLD, 0, 0, 0, 0);
+}
+
+int z_futex_wait(uint32_t *uaddr, uint32_t val)
+{
+	return (int)SYSCALL(futex, uaddr, FUTEX_WAIT, val, NULL);
+}
+
+int z_futex_timedwait(uint32_t *uaddr, uint32_t val, const struct timespec *rel)
+{
+	return (int)SYSCALL(futex, uaddr, FUTEX_WAIT, val, rel);
+}
+
+int z_futex_wake(uint32_t *uaddr, int nr)
+{
+	return (int)SYSCALL(futex, uaddr, FUTEX_WAKE, nr);
+}
 
 void *
 z_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
@@ -53,8 +235,88 @@ z_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 	 * In same time mmap2 does not exist on x86-64.
 	 */
 #ifdef SYS_mmap2
-	return (void *)SYSCALL(mmap2, addr, length, prot, flags, fd, offset >> 12);
+	return (void *)SYSCALL_LEN(mmap2, length, addr, length, prot, flags, fd, offset >> 12);
 #else
-	return (void *)SYSCALL(mmap, addr, length, prot, flags, fd, offset);
+	return (void *)SYSCALL_LEN(mmap, length, addr, length, prot, flags, fd, offset);
 #endif
 }
+
+#ifdef Z_STATS
+/* 64-bit shift-subtract, we link no libgcc for __udivdi3. */
+static uint64_t udiv64(uint64_t n, uint64_t d)
+{
+	uint64_t q = 0, bit = 1;
+
+	if (d == 0)
+		return 0;
+	while ((d << 1) > d && (d << 1) <= n)
+	{
+		d <<= 1;
+		bit <<= 1;
+	}
+	for (; bit; d >>= 1, bit >>= 1)
+	{
+		if (n >= d)
+		{
+			n -= d;
+			q |= bit;
+		}
+	}
+	return q;
+}
+
+static char *put_field(char *p, const char *s, uint64_t v, int width)
+{
+	char tmp[24], *t = tmp;
+
+	if (s)
+	{
+		for (; *s; width--)
+			*p++ = *s++;
+		for (; width > 0; width--)
+			*p++ = ' ';
+		return p;
+	}
+	do
+	{
+		*t++ = '0' + (v - udiv64(v, 10) * 10);
+		v = udiv64(v, 10);
+	} while (v);
+	for (width -= t - tmp; width > 0; width--)
+		*p++ = ' ';
+	while (t > tmp)
+		*p++ = *--t;
+	return p;
+}
+
+void z_stats_dump(int fd)
+{
+	static uint32_t dumped;
+	static char out[4096];
+	uint64_t ticks = z_ticks() - g_tick0, ns, t;
+	struct timespec ts;
+	z_stat_t *st;
+	char *p = out;
+
+	if (!g_tick0 || __atomic_exchange_n(&dumped, 1, __ATOMIC_RELAXED))
+		return;
+	/* Scale ticks to time with what they did against CLOCK_MONOTONIC. */
+	z_syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+	ns = (uint64_t)(ts.tv_sec - g_ts0.tv_sec) * 1000000000ULL + ts.tv_nsec - g_ts0.tv_nsec;
+
+	p = put_field(p, "syscall            calls       bytes          ns\n", 0, 0);
+	for (st = __atomic_load_n(&g_stats, __ATOMIC_ACQUIRE); st; st = st->next)
+	{
+		if (p > out + sizeof(out) - 64)
+			break;
+		/* ns = st->ticks * ns / ticks, without overflowing 64 bits */
+		t = udiv64(st->ticks * udiv64(ns << 10, ticks + 1), 1 << 10);
+		p = put_field(p, st->name, 0, 16);
+		p = put_field(p, NULL, st->calls, 8);
+		p = put_field(p, NULL, st->bytes, 12);
+		p = put_field(p, NULL, t, 12);
+		*p++ = '\n';
+	}
+	z_syscall(SYS_write, fd, out, p - out);
+}
+#endif
@@ -4,22 +4,78 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 
 #include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
 #define z_errno (*z_perrno())
 
+struct sigevent;
+
+/* The kernel's struct sigaction, the one rt_sigaction() takes. */
+struct z_sigaction
+{
+	void (*handler)(int, void *, void *);
+	unsigned long flags;
+	void (*restorer)(void);
+	uint64_t mask;
+};
+
 void z_exit(int status);
 int z_open(const char *pathname, int flags);
+/* For O_CREAT, which needs a mode. */
+int z_open_mode(const char *pathname, int flags, int mode);
 int z_close(int fd);
 int z_lseek(int fd, off_t offset, int whence);
 ssize_t z_read(int fd, void *buf, size_t count);
 ssize_t z_write(int fd, const void *buf, size_t count);
+ssize_t z_writev(int fd, const struct iovec *iov, int iovcnt);
 void *z_mmap(void *addr, size_t length, int prot,
 			 int flags, int fd, off_t offset);
 int z_munmap(void *addr, size_t length);
 int z_mprotect(void *addr, size_t length, int prot);
+int z_madvise(void *addr, size_t length, int advice);
 int *z_perrno(void);
+pid_t z_getpid(void);
+int z_kill(pid_t pid, int sig);
+pid_t z_fork(void);
+pid_t z_wait4(pid_t pid, int *status, int options, void *rusage);
+int z_ftruncate(int fd, off_t length);
+int z_memfd_create(const char *name, unsigned int flags);
+int z_clock_gettime(clockid_t clk, struct timespec *ts);
+int z_sched_getaffinity(pid_t pid, size_t size, void *mask);
+int z_sched_setaffinity(pid_t pid, size_t size, const void *mask);
+int z_execve(const char *path, char *const argv[], char *const envp[]);
+int z_pipe2(int *fds, int flags);
+int z_dup3(int oldfd, int newfd, int flags);
+long z_ptrace(long req, pid_t pid, void *addr, void *data);
+int z_getdents64(int fd, void *buf, size_t count);
+/* Fills in restorer and SA_RESTORER, the kernel needs them on x86. */
+int z_rt_sigaction(int sig, struct z_sigaction *act, struct z_sigaction *old);
+/* Kernel timer ids are ints, not the libc's timer_t. */
+int z_timer_create(clockid_t clock, struct sigevent *sev, int *id);
+int z_timer_settime(int id, int flags, const struct itimerspec *val,
+					struct itimerspec *old);
+int z_timer_delete(int id);
+int z_prctl(int option, unsigned long a2, unsigned long a3, unsigned long a4,
+			unsigned long a5);
+/* Futexes are always shared, callers may live in different processes. */
+int z_futex_wait(uint32_t *uaddr, uint32_t val);
+/* Gives up after rel (relative, NULL waits forever), -1 with ETIMEDOUT. */
+int z_futex_timedwait(uint32_t *uaddr, uint32_t val, const struct timespec *rel);
+int z_futex_wake(uint32_t *uaddr, int nr);
+
+#ifdef Z_STATS
+/* Per wrapper calls, bytes and time so far, printed once. */
+void z_stats_dump(int fd);
+#else
+#define z_stats_dump(fd) \
+	do                   \
+	{                    \
+	} while (0)
+#endif
 
 #endif /* Z_SYSCALLS_H */
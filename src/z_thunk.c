@@ -0,0 +1,119 @@
+#include "z_asm.h"
+#include "z_syscalls.h"
+#include "z_thunk.h"
+#include "z_utils.h"
+
+/* Must match <arch>/z_thunk.S: the data of a slot sits one THUNK_PAGE
+ * after its code, which takes at most THUNK_SLOT bytes. */
+#if defined(__aarch64__)
+#define THUNK_PAGE 65536
+#else
+#define THUNK_PAGE 4096
+#endif
+#define THUNK_SLOT 64
+#define THUNK_COUNT (THUNK_PAGE / THUNK_SLOT)
+
+typedef struct
+{
+	void *ctx; /* next free slot while unused */
+	void *fn;
+} thunk_data_t;
+
+static char *g_free;
+static uint32_t g_lock;
+
+static void lock(void)
+{
+	while (__atomic_exchange_n(&g_lock, 1, __ATOMIC_ACQUIRE))
+		z_cpu_relax();
+}
+
+static void unlock(void)
+{
+	__atomic_store_n(&g_lock, 0, __ATOMIC_RELEASE);
+}
+
+static thunk_data_t *data_of(char *slot)
+{
+	return (thunk_data_t *)(slot + THUNK_PAGE);
+}
+
+static void flush_icache(char *start, char *end)
+{
+#if defined(__aarch64__)
+	unsigned long ctr, dline, iline;
+	char *p;
+
+	__asm__ volatile("mrs %0, ctr_el0" : "=r"(ctr));
+	dline = 4UL << ((ctr >> 16) & 15);
+	iline = 4UL << (ctr & 15);
+	for (p = (char *)((unsigned long)start & ~(dline - 1)); p < end; p += dline)
+		__asm__ volatile("dc cvau, %0" ::"r"(p) : "memory");
+	__asm__ volatile("dsb ish" ::: "memory");
+	for (p = (char *)((unsigned long)start & ~(iline - 1)); p < end; p += iline)
+		__asm__ volatile("ic ivau, %0" ::"r"(p) : "memory");
+	__asm__ volatile("dsb ish\n\tisb" ::: "memory");
+#elif defined(__arm__)
+	z_syscall(0xf0002, start, end, 0); /* __ARM_NR_cacheflush */
+#else
+	(void)start;
+	(void)end;
+#endif
+}
+
+/* A code page of template copies followed by their data page. Called with
+ * the lock held. */
+static int grow(void)
+{
+	size_t len = (char *)z_thunk_tmpl_end - (char *)z_thunk_tmpl;
+	char *code;
+	int i;
+
+	if (len > THUNK_SLOT)
+		return -1;
+	code = z_mmap(NULL, 2 * THUNK_PAGE, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == (void *)-1)
+		return -1;
+	for (i = 0; i < THUNK_COUNT; i++)
+		z_memcpy(code + i * THUNK_SLOT, (void *)z_thunk_tmpl, len);
+	flush_icache(code, code + THUNK_PAGE);
+	if (z_mprotect(code, THUNK_PAGE, PROT_READ | PROT_EXEC) < 0)
+	{
+		z_munmap(code, 2 * THUNK_PAGE);
+		return -1;
+	}
+	for (i = THUNK_COUNT; i-- > 0;)
+	{
+		data_of(code + i * THUNK_SLOT)->ctx = g_free;
+		g_free = code + i * THUNK_SLOT;
+	}
+	return 0;
+}
+
+void *z_thunk_new(void *fn, void *ctx)
+{
+	char *slot = NULL;
+
+	lock();
+	if (g_free || grow() == 0)
+	{
+		slot = g_free;
+		g_free = data_of(slot)->ctx;
+		data_of(slot)->ctx = ctx;
+		data_of(slot)->fn = fn;
+	}
+	unlock();
+	return slot;
+}
+
+void z_thunk_free(void *thunk)
+{
+	if (!thunk)
+		return;
+	lock();
+	data_of(thunk)->fn = NULL;
+	data_of(thunk)->ctx = g_free;
+	g_free = thunk;
+	unlock();
+}
@@ -0,0 +1,18 @@
+#ifndef Z_THUNK_H
+#define Z_THUNK_H
+
+/*
+ * Callbacks for foreign APIs that take a bare function pointer, such as
+ * qsort(). A thunk called as t(a, b, ...) calls fn(ctx, a, b, ...) on the
+ * same stack, with one extra move per argument and an indirect jump. Only
+ * word sized integer and pointer arguments are passed on: 5 on amd64, 7 on
+ * aarch64, 3 on arm, and 4 stack words on i386 (cdecl). Floating point
+ * arguments go through untouched. fn runs on the foreign thread, so it
+ * must not rely on anything the static side sets up per thread.
+ */
+
+/* NULL when out of memory. */
+void *z_thunk_new(void *fn, void *ctx);
+void z_thunk_free(void *thunk);
+
+#endif /* Z_THUNK_H */
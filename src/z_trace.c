@@ -0,0 +1,67 @@
+#include "z_trace.h"
+#include "z_syscalls.h"
+#include "z_utils.h"
+
+typedef struct
+{
+	const char *ev;
+	long arg;
+	unsigned long sec, nsec;
+} point_t;
+
+static point_t g_points[Z_TRACE_MAX];
+static uint32_t g_count;
+static uint32_t g_dumped;
+
+void z_trace(const char *ev, long arg)
+{
+	uint32_t i = __atomic_fetch_add(&g_count, 1, __ATOMIC_RELAXED);
+	struct timespec ts;
+
+	if (i >= Z_TRACE_MAX)
+		return;
+	z_clock_gettime(CLOCK_MONOTONIC, &ts);
+	g_points[i].ev = ev;
+	g_points[i].arg = arg;
+	g_points[i].sec = ts.tv_sec;
+	g_points[i].nsec = ts.tv_nsec;
+}
+
+static unsigned long ns_since(const point_t *a, const point_t *b)
+{
+	return (b->sec - a->sec) * 1000000000UL + b->nsec - a->nsec;
+}
+
+void z_trace_dump(void)
+{
+	/* Longest line is well under 128 bytes with our short names. */
+	static char out[Z_TRACE_MAX * 128];
+	const char *v = z_getenv("FDL_TRACE_FD");
+	uint32_t n = __atomic_load_n(&g_count, __ATOMIC_ACQUIRE), i;
+	char *p = out;
+	int fd = 0;
+
+	if (!v || !*v || __atomic_exchange_n(&g_dumped, 1, __ATOMIC_RELAXED))
+		return;
+	for (; *v >= '0' && *v <= '9'; v++)
+		fd = fd * 10 + (*v - '0');
+	if (n > Z_TRACE_MAX)
+		n = Z_TRACE_MAX;
+	for (i = 0; i < n; i++)
+	{
+		const point_t *pt = &g_points[i];
+
+		p = z_fmt_str(p, "{\"ev\":\"");
+		p = z_fmt_str(p, pt->ev);
+		p = z_fmt_str(p, "\",\"arg\":");
+		if (pt->arg < 0)
+			*p++ = '-';
+		p = z_fmt_ulong(p, pt->arg < 0 ? -(unsigned long)pt->arg : (unsigned long)pt->arg);
+		p = z_fmt_str(p, ",\"ns\":");
+		p = z_fmt_ulong(p, ns_since(&g_points[0], pt));
+		p = z_fmt_str(p, ",\"dt\":");
+		p = z_fmt_ulong(p, i ? ns_since(pt - 1, pt) : 0);
+		p = z_fmt_str(p, "}\n");
+	}
+	z_write(fd, out, p - out);
+}
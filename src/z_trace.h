@@ -0,0 +1,32 @@
+#ifndef Z_TRACE_H
+#define Z_TRACE_H
+
+/*
+ * Bootstrap trace points, built in with TRACE=1 only. z_trace() stamps a
+ * named point with CLOCK_MONOTONIC into a static table, z_trace_dump()
+ * writes the table as JSON lines to the fd in FDL_TRACE_FD:
+ *
+ *   {"ev":"loadelf","arg":1,"ns":183402,"dt":41211}
+ *
+ * ns counts from the first point, dt from the previous one, so dt of a
+ * point is the time spent in the phase it closes.
+ */
+
+#define Z_TRACE_MAX 64
+
+#ifdef Z_TRACE
+void z_trace(const char *ev, long arg);
+/* Writes once, later calls do nothing. */
+void z_trace_dump(void);
+#else
+#define z_trace(ev, arg) \
+	do                   \
+	{                    \
+	} while (0)
+#define z_trace_dump() \
+	do                 \
+	{                  \
+	} while (0)
+#endif
+
+#endif /* Z_TRACE_H */
@@ -1,51 +1,335 @@
+#include <stdint.h>
 #include <stdlib.h>
+#include <linux/auxvec.h>
+
+#include "z_simd.h"
+#include "z_utils.h"
 
 /* satisfy compiler-emitted calls under -O2/-Os with no libc */
 void *memset(void *s, int c, size_t n) __attribute__((alias("z_memset")));
 void *memcpy(void *d, const void *s, size_t n) __attribute__((alias("z_memcpy")));
 
 
+/* Our own environment, set up by z_entry(). */
+char **z_environ;
+
+char *z_getenv(const char *name)
+{
+	return z_getenv_from(z_environ, name);
+}
+
+char *z_getenv_from(char **env, const char *name)
+{
+	char **e;
+	const char *n, *v;
+
+	for (e = env; e && *e; e++)
+	{
+		for (n = name, v = *e; *n && *n == *v; n++, v++)
+			;
+		if (!*n && *v == '=')
+			return (char *)v + 1;
+	}
+	return NULL;
+}
+
+/*
+ * Word at a time helpers. Loads through z_word_t may alias anything, the
+ * unaligned flavour lets the compiler pick a safe load on strict-alignment
+ * arches. String scans only do aligned loads, they never cross a page.
+ */
+typedef unsigned long __attribute__((__may_alias__)) z_word_t;
+typedef unsigned long __attribute__((__may_alias__, __aligned__(1))) z_uword_t;
+
+#define WSIZE sizeof(z_word_t)
+#define ONES ((z_word_t)-1 / 0xff)
+#define HIGHS (ONES * 0x80)
+#define HASZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+#define ALIGNED(p, a) (((uintptr_t)(p) & ((a) - 1)) == 0)
+
+#if defined(__SSE2__) || defined(__aarch64__) || defined(__ARM_NEON)
+int z_simd = 1;
+#else
+int z_simd; /* until z_cpu_init() finds the vector unit */
+#endif
+
+unsigned long z_getauxval(unsigned long type)
+{
+	char **e = z_environ;
+	unsigned long *av;
+
+	if (!e)
+		return 0;
+	while (*e)
+		e++;
+	for (av = (unsigned long *)(e + 1); av[0] != AT_NULL; av += 2)
+		if (av[0] == type)
+			return av[1];
+	return 0;
+}
+
+void z_cpu_init(void)
+{
+	unsigned long hwcap = z_getauxval(AT_HWCAP);
+
+#if defined(__i386__) && !defined(__SSE2__)
+	z_simd = (hwcap >> 26) & 1; /* CPUID.1:EDX.SSE2 */
+#elif defined(__arm__) && defined(__ARM_NEON)
+	z_simd = (hwcap >> 12) & 1; /* HWCAP_NEON */
+#else
+	(void)hwcap;
+#endif
+}
+
+#ifdef Z_VEC
+static ZV_TARGET size_t vec_set(unsigned char *p, int c, size_t n)
+{
+	zv_t v = zv_splat(c);
+	size_t i;
+
+	for (i = 0; i + ZV_SIZE <= n; i += ZV_SIZE)
+		zv_storeu(p + i, v);
+	return i;
+}
+
+static ZV_TARGET size_t vec_copy(unsigned char *d, const unsigned char *s, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i + 2 * ZV_SIZE <= n; i += 2 * ZV_SIZE)
+	{
+		zv_t a = zv_loadu(s + i), b = zv_loadu(s + i + ZV_SIZE);
+		zv_storeu(d + i, a);
+		zv_storeu(d + i + ZV_SIZE, b);
+	}
+	return i;
+}
+
+/* Skip the common prefix of co-aligned p and q, stops at most one block
+ * before the first difference or NUL. */
+static ZV_TARGET void vec_skip_equal(const unsigned char **pp, const unsigned char **qq)
+{
+	const unsigned char *p = *pp, *q = *qq;
+
+	for (; !ALIGNED(p, ZV_SIZE); p++, q++)
+		if (*p != *q || !*p)
+			goto out;
+	while (!zv_stop(zv_load(p), zv_load(q)))
+	{
+		p += ZV_SIZE;
+		q += ZV_SIZE;
+	}
+out:
+	*pp = p;
+	*qq = q;
+}
+
+static ZV_TARGET const unsigned char *vec_find(const unsigned char *s, unsigned char c)
+{
+	zv_t v = zv_splat(c);
+
+	for (; !ALIGNED(s, ZV_SIZE); s++)
+		if (*s == c || !*s)
+			return s;
+	while (!zv_hit(zv_load(s), v))
+		s += ZV_SIZE;
+	return s;
+}
+#endif
+
 void *z_memset(void *s, int c, size_t n)
 {
-	unsigned char *p = s, *e = p + n;
-	while (p < e)
+	unsigned char *p = s;
+
+	if (n >= 2 * WSIZE)
+	{
+		z_word_t w = ONES * (unsigned char)c;
+
+		for (; !ALIGNED(p, WSIZE); n--)
+			*p++ = c;
+#ifdef Z_VEC
+		if (n >= 4 * ZV_SIZE && z_simd)
+		{
+			size_t done = vec_set(p, c, n);
+			p += done;
+			n -= done;
+		}
+#endif
+		for (; n >= WSIZE; n -= WSIZE, p += WSIZE)
+			*(z_word_t *)p = w;
+	}
+	while (n--)
 		*p++ = c;
 	return s;
 }
 
+/* Copies forward, overlapping buffers are not supported. */
 void *z_memcpy(void *dest, const void *src, size_t n)
 {
 	unsigned char *d = dest;
-	const unsigned char *p = src, *e = p + n;
-	while (p < e)
-		*d++ = *p++;
+	const unsigned char *s = src;
+
+	if (n >= 2 * WSIZE)
+	{
+		for (; !ALIGNED(d, WSIZE); n--)
+			*d++ = *s++;
+#ifdef Z_VEC
+		if (n >= 4 * ZV_SIZE && z_simd)
+		{
+			size_t done = vec_copy(d, s, n);
+			d += done;
+			s += done;
+			n -= done;
+		}
+#endif
+		for (; n >= WSIZE; n -= WSIZE, d += WSIZE, s += WSIZE)
+			*(z_word_t *)d = *(const z_uword_t *)s;
+	}
+	while (n--)
+		*d++ = *s++;
 	return dest;
 }
 
+int z_memcmp(const void *a, const void *b, size_t n)
+{
+	const unsigned char *p = a, *q = b;
+	for (; n; n--, p++, q++)
+		if (*p != *q)
+			return *p - *q;
+	return 0;
+}
+
+/* First byte of s that is c or the terminating NUL. */
+static const unsigned char *find_byte(const unsigned char *s, unsigned char c)
+{
+	z_word_t cw = ONES * c, x;
+
+	for (; !ALIGNED(s, WSIZE); s++)
+		if (*s == c || !*s)
+			return s;
+#ifdef Z_VEC
+	if (z_simd)
+		s = vec_find(s, c);
+	else
+#endif
+		for (; x = *(const z_word_t *)s, !HASZERO(x) && !HASZERO(x ^ cw); s += WSIZE)
+			;
+	while (*s != c && *s)
+		s++;
+	return s;
+}
+
 char *z_strstr(const char *h, const char *n)
 {
+	const unsigned char *p = (const unsigned char *)h;
+
 	if (!*n)
 		return (char *)h;
-	for (; *h; h++)
+	for (;; p++)
 	{
-		const char *p = h, *q = n;
-		while (*p && *q && *p == *q)
-		{
-			p++;
-			q++;
-		}
-		if (!*q)
-			return (char *)h;
+		const char *a, *b;
+
+		p = find_byte(p, *n);
+		if (!*p)
+			return NULL;
+		for (a = (const char *)p + 1, b = n + 1; *b && *a == *b; a++, b++)
+			;
+		if (!*b)
+			return (char *)p;
 	}
-	return NULL;
 }
 
 int z_strcmp(const char *a, const char *b)
 {
-	while (*a && (*a == *b))
+	const unsigned char *p = (const unsigned char *)a, *q = (const unsigned char *)b;
+
+	/* Whole blocks only when both strings reach alignment together. */
+	if (ALIGNED((uintptr_t)p ^ (uintptr_t)q, WSIZE))
+	{
+		for (; !ALIGNED(p, WSIZE); p++, q++)
+			if (*p != *q || !*p)
+				return *p - *q;
+#ifdef Z_VEC
+		if (z_simd && ALIGNED((uintptr_t)p ^ (uintptr_t)q, ZV_SIZE))
+			vec_skip_equal(&p, &q);
+		else
+#endif
+			for (; !HASZERO(*(const z_word_t *)p) &&
+				   *(const z_word_t *)p == *(const z_word_t *)q;
+				 p += WSIZE, q += WSIZE)
+				;
+	}
+	while (*p && *p == *q)
+	{
+		p++;
+		q++;
+	}
+	return *p - *q;
+}
+
+/* Shift-subtract division, we link no libgcc so arm has no __aeabi_uldivmod. */
+unsigned long z_udivmod(unsigned long n, unsigned long d, unsigned long *rem)
+{
+	unsigned long q = 0, bit = 1;
+
+	if (d == 0)
+	{
+		if (rem)
+			*rem = 0;
+		return 0;
+	}
+	while ((d << 1) > d && (d << 1) <= n)
+	{
+		d <<= 1;
+		bit <<= 1;
+	}
+	while (bit)
 	{
-		a++;
-		b++;
+		if (n >= d)
+		{
+			n -= d;
+			q |= bit;
+		}
+		d >>= 1;
+		bit >>= 1;
 	}
-	return (unsigned char)*a - (unsigned char)*b;
+	if (rem)
+		*rem = n;
+	return q;
+}
+
+char *z_fmt_str(char *p, const char *s)
+{
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
+char *z_fmt_ulong(char *p, unsigned long v)
+{
+	char tmp[24], *t = tmp;
+	unsigned long rem;
+
+	do
+	{
+		v = z_udivmod(v, 10, &rem);
+		*t++ = '0' + rem;
+	} while (v);
+	while (t > tmp)
+		*p++ = *--t;
+	return p;
+}
+
+char *z_fmt_hex(char *p, unsigned long v)
+{
+	char tmp[2 * sizeof(v)], *t = tmp;
+
+	do
+	{
+		*t++ = "0123456789abcdef"[v & 15];
+		v >>= 4;
+	} while (v);
+	while (t > tmp)
+		*p++ = *--t;
+	return p;
 }
@@ -9,15 +9,48 @@
 
 #define z_alloca __builtin_alloca
 
+/* Busy-wait hint for spin loops. */
+static inline void z_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ volatile("pause" ::: "memory");
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ volatile("yield" ::: "memory");
+#else
+	__asm__ volatile("" ::: "memory");
+#endif
+}
+
+extern char **z_environ;
+char *z_getenv(const char *name);
+/* The same, in another NULL terminated env. */
+char *z_getenv_from(char **env, const char *name);
+/* Auxiliary vector entry, found past z_environ. 0 if absent. */
+unsigned long z_getauxval(unsigned long type);
+
+/* Non-zero when z_mem*()/z_str*() may use the vector unit. */
+extern int z_simd;
+/* Pick the z_utils implementations from AT_HWCAP, needs z_environ. */
+void z_cpu_init(void);
+
 void *z_memset(void *s, int c, size_t n);
 void *z_memcpy(void *dest, const void *src, size_t n);
+int z_memcmp(const void *a, const void *b, size_t n);
 int z_strcmp(const char *a, const char *b);
 char *z_strstr(const char *haystack, const char *needle);
+unsigned long z_udivmod(unsigned long n, unsigned long d, unsigned long *rem);
+/* printf-free formatting, for reports that SMALL builds print too. Each
+ * writes at p without a terminator and returns the end. */
+char *z_fmt_str(char *p, const char *s);
+char *z_fmt_ulong(char *p, unsigned long v);
+char *z_fmt_hex(char *p, unsigned long v);
 
 void z_sprintn(char *buf, unsigned long ul, int base);
 
 void z_vprintf(const char *fmt, va_list ap);
 void z_vfdprintf(int fd, const char *fmt, va_list ap);
+/* Returns the length it wanted, like vsnprintf(). */
+int z_vsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
 void z_printf(const char *fmt, ...)
 	__attribute__((format(printf, 1, 2)));
 void z_fdprintf(int fd, const char *fmt, ...)